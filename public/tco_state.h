@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2011 Research In Motion Limited.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _TCO_STATE_H_INCLUDED
+#define _TCO_STATE_H_INCLUDED
+
+#include <sys/platform.h>
+
+__BEGIN_DECLS
+
+#define TCO_STATE_MAX_KEYS 512
+
+/**
+ * Input state kept by the overlay, see tco_get_state.
+ * Touch deltas only grow, compare two snapshots to get the motion
+ * between them.
+ */
+struct tco_state {
+	unsigned int sequence;                        /* bumped on every change */
+	unsigned int keys[TCO_STATE_MAX_KEYS / 32];   /* pressed key symbols, one bit each */
+	unsigned int mouse_buttons;                   /* pressed mouse buttons, one bit each */
+	int dpad_active;
+	int dpad_angle;
+	int touch_dx;                                 /* accumulated touch area motion */
+	int touch_dy;
+	int touchscreen_x;                            /* last touch screen position */
+	int touchscreen_y;
+	int analog_x;                                 /* last analog output, 16.16 fixed point */
+	int analog_y;
+	int analog_magnitude;
+};
+
+/**
+ * Returns non-zero if key symbol sym is held in the snapshot.
+ */
+int tco_state_key_down(const struct tco_state * state,
+                       int sym);
+
+/*
+ * Reader side of a state published with tco_publish_state.
+ * Needs nothing but libc, so it can be used by processes that
+ * do not own a screen context.
+ */
+struct tco_shm_reader;
+typedef struct tco_shm_reader * tco_shm_reader_t;
+
+/**
+ * Map the shared memory object name read-only.
+ * Returns NULL and sets errno on failure.
+ */
+tco_shm_reader_t tco_shm_open(const char * name);
+
+/**
+ * Copy a consistent snapshot of the published state. Reads memory
+ * only, no system calls. Returns 0, or -1 with errno set to EAGAIN
+ * if the publisher stays in the middle of an update.
+ */
+int tco_shm_read(tco_shm_reader_t reader,
+                 struct tco_state * state);
+
+/**
+ * Unmap the shared memory object.
+ */
+void tco_shm_close(tco_shm_reader_t reader);
+
+__END_DECLS
+
+#endif /* _TCO_STATE_H_INCLUDED */
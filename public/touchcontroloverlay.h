@@ -20,6 +20,7 @@
 #include <sys/platform.h>
 #include <screen/screen.h>
 #include <bps/event.h>
+#include "tco_state.h"
 
 __BEGIN_DECLS
 
@@ -50,8 +51,16 @@ struct tco_callbacks {
 	int (*handleMouseButtonFunc)(int button, int mask, int event); /* TODO: Unify keyboard mod with mouse mask */
 	int (*handleTapFunc)();
 	int (*handleTouchScreenFunc)(int x, int y, int tap, int hold);
+	int (*handleAnalogFunc)(int x, int y, int magnitude, int event); /* 16.16 fixed point, see TCO_ANALOG_ONE */
+	int (*handleGestureFunc)(int gesture, int a, int b, int event); /* see GestureType */
 };
 
+/**
+ * Full deflection of an analog control, x and y follow screen
+ * orientation and magnitude runs from 0 to TCO_ANALOG_ONE.
+ */
+#define TCO_ANALOG_ONE 65536
+
 enum KeyButtonState {
 	TCO_KB_DOWN = 0,
 	TCO_KB_UP = 1
@@ -74,6 +83,118 @@ enum MouseButtonState {
 	TCO_MOUSE_BUTTON_UP = 1
 };
 
+/**
+ * Gestures of a gesture control and the meaning of a and b:
+ * pinch a is the scale since the gesture began, rotate a is the
+ * rotation since it began in degrees, both 16.16 fixed point.
+ * Pan a and b are the motion of the two finger center since the last
+ * pan event. Swipe a is a SwipeDirection and b the speed in pixels
+ * per second, it is only sent as TCO_GESTURE_END.
+ */
+enum GestureType {
+	TCO_GESTURE_PINCH = 0,
+	TCO_GESTURE_ROTATE = 1,
+	TCO_GESTURE_PAN = 2,
+	TCO_GESTURE_SWIPE = 3
+};
+
+enum GestureState {
+	TCO_GESTURE_BEGIN = 0,
+	TCO_GESTURE_UPDATE = 1,
+	TCO_GESTURE_END = 2
+};
+
+enum SwipeDirection {
+	TCO_SWIPE_LEFT = 0,
+	TCO_SWIPE_RIGHT = 1,
+	TCO_SWIPE_UP = 2,
+	TCO_SWIPE_DOWN = 3
+};
+
+/**
+ * Kinds of actions delivered by tco_poll_actions, one per callback.
+ */
+enum tco_action_type {
+	TCO_ACTION_KEY = 0,
+	TCO_ACTION_DPAD = 1,
+	TCO_ACTION_TOUCH = 2,
+	TCO_ACTION_MOUSE_BUTTON = 3,
+	TCO_ACTION_TAP = 4,
+	TCO_ACTION_TOUCHSCREEN = 5,
+	TCO_ACTION_ANALOG = 6,
+	TCO_ACTION_GESTURE = 7
+};
+
+/**
+ * Action record, carries the arguments of the matching callback.
+ */
+struct tco_action {
+	int type;  /* tco_action_type */
+	int event; /* KeyButtonState, MouseButtonState or GestureState */
+	union {
+		struct {
+			int sym;
+			int mod;
+			int scancode;
+			unsigned short unicode;
+		} key;
+		struct {
+			int angle;
+		} dpad;
+		struct {
+			int dx;
+			int dy;
+		} touch;
+		struct {
+			int button;
+			int mask;
+		} mouse;
+		struct {
+			int x;
+			int y;
+			int tap;
+			int hold;
+		} touchscreen;
+		struct {
+			int x;
+			int y;
+			int magnitude;
+		} analog;
+		struct {
+			int gesture;
+			int a;
+			int b;
+		} gesture;
+	} data;
+};
+
+/**
+ * Bytes held by the overlay in one category.
+ */
+struct tco_memory_counter {
+	size_t current;
+	size_t peak;
+};
+
+/**
+ * Memory held by the overlay, see tco_get_memory_usage.
+ */
+struct tco_memory_usage {
+	struct tco_memory_counter window_buffers; /* label and configuration window buffers */
+	struct tco_memory_counter pixmaps;        /* pixmaps used to upload label images */
+	struct tco_memory_counter heap;           /* context, profiles and layout arenas */
+	struct tco_memory_counter cached_images;  /* decoded image data */
+	struct tco_memory_counter total;
+};
+
+/**
+ * Touch events dropped in latest wins mode, see tco_set_latest_wins.
+ */
+struct tco_event_stats {
+	unsigned long superseded_moves; /* older than a move already handled */
+	unsigned long stale_moves;      /* older than the age limit */
+};
+
 struct tco_context;
 typedef struct tco_context * tco_context_t;
 /**
@@ -88,6 +209,55 @@ int tco_loadcontrols(tco_context_t context,
                      const char* default_filename,
                      const char* user_filename);
 
+/**
+ * Load the controls from a file into a named layout profile.
+ * The profile stays resident until shutdown, the active profile
+ * is not changed. Loading an existing profile replaces its controls.
+ * The profile filled by tco_loadcontrols is named "default".
+ */
+int tco_loadprofile(tco_context_t context,
+                    const char* name,
+                    const char* default_filename,
+                    const char* user_filename);
+
+/**
+ * Make a loaded profile active. Hides the labels of the previous
+ * profile, shows the labels of the new one and swaps the controls
+ * used for hit-testing. No files are read and no windows are created.
+ */
+int tco_set_profile(tco_context_t context,
+                    const char* name);
+
+/**
+ * Show or hide the controls whose "layer" is layer, 0 to 31. Hidden
+ * controls take no touches and contacts they hold are released. The
+ * setting applies to every profile. The labels of the active profile
+ * change together in one screen flush.
+ */
+int tco_set_layer_visible(tco_context_t context,
+                          int layer,
+                          int visible);
+
+/**
+ * Set how the configuration window moves controls. With snap above 0
+ * dragged controls land on a grid of that many pixels. With
+ * avoid_overlap set a control does not move onto another visible one
+ * and slides along it instead. Both are off by default.
+ */
+int tco_set_editor_grid(tco_context_t context,
+                        int snap,
+                        int avoid_overlap);
+
+/**
+ * Fade the labels out over fade_ms once idle_ms have passed without a
+ * touch, then hide them until the next touch brings them back. The
+ * fade runs on deadlines, see tco_tick. Pass idle_ms 0 to keep the
+ * labels shown, which is the default.
+ */
+int tco_set_idle_policy(tco_context_t context,
+                        int idle_ms,
+                        int fade_ms);
+
 /**
  * Saves the controls to a file.
  */
@@ -99,11 +269,86 @@ int tco_handle_events(tco_context_t context,
                       screen_window_t window,
                       bps_event_t * event);
 
+/**
+ * Copy up to max_actions queued actions, oldest first.
+ * Returns the number of actions copied.
+ */
+int tco_poll_actions(tco_context_t context,
+                     struct tco_action * actions,
+                     int max_actions);
+
+/**
+ * Get a descriptor that becomes readable while actions are queued.
+ * The first call switches the context to queued mode: actions from
+ * tco_handle_events are no longer passed to the callbacks but kept
+ * for tco_poll_actions, which also clears the descriptor once the
+ * queue is drained. Do not read from the descriptor directly.
+ */
+int tco_get_fd(tco_context_t context);
+
+/**
+ * Copy a consistent snapshot of the input state. Safe to call from
+ * any thread, never blocks or allocates.
+ */
+int tco_get_state(tco_context_t context,
+                  struct tco_state * state);
+
+/**
+ * Publish the input state in the POSIX shared memory object name,
+ * for other processes to map with tco_shm_open. The object is
+ * removed on shutdown.
+ */
+int tco_publish_state(tco_context_t context,
+                      const char * name);
+
+/**
+ * Fire timed events, such as holds and key repeats, due at now, in nanoseconds
+ * of CLOCK_MONOTONIC. Pass 0 to read the clock. Screen event timestamps
+ * are converted to this clock as events arrive, so deadlines set by
+ * touches compare against it as well. Due deadlines also fire on the
+ * next touch event, call this to get them on time while no events arrive.
+ */
+int tco_tick(tco_context_t context,
+             long long now);
+
+/**
+ * Milliseconds from now until the next deadline, for use as a
+ * bps_get_event or poll timeout. now is in nanoseconds of
+ * CLOCK_MONOTONIC, as for tco_tick, pass 0 to read the clock.
+ * Returns -1 if nothing is pending.
+ */
+int tco_get_timeout(tco_context_t context,
+                    long long now);
+
+/**
+ * Only handle the latest position of each contact. Moves arriving out
+ * of order are dropped before they reach the controls. When max_age_ms
+ * is not 0, so are moves that reach the overlay more than max_age_ms
+ * later than the quickest event delivered so far. Presses and releases
+ * are always handled. Off by default.
+ */
+int tco_set_latest_wins(tco_context_t context,
+                        int enable,
+                        int max_age_ms);
+
+/**
+ * Get the number of touch events dropped so far.
+ */
+int tco_get_event_stats(tco_context_t context,
+                        struct tco_event_stats * stats);
+
 /**
  * Show overlay labels
  */
 int tco_draw(tco_context_t context, screen_window_t window);
 
+/**
+ * Get the memory held by the overlay. The counters are kept up to
+ * date as resources come and go, this call only copies them.
+ */
+int tco_get_memory_usage(tco_context_t context,
+                         struct tco_memory_usage * usage);
+
 /**
  * Cleanup and shutdown
  */
@@ -2,6 +2,7 @@
 #include "errno.h"
 #include "string.h"
 #include "stdbool.h"
+#include "stdint.h"
 #include <png.h>
 #include <bps/bps.h>
 #include <bps/screen.h>
@@ -10,11 +11,78 @@
 #include "touchcontroloverlay.h"
 #include <queue.h>
 #include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <limits.h>
 #include <cJSON.h>
+#include "tco_pixel.h"
+#include "tco_shm.h"
 
 /* Maximum number of defined controls */
 #define MAX_TCO_CONTROLS 16
 
+/* Size of the cache line the hot part of a control is laid out in */
+#define TCO_CACHE_LINE 64
+
+/* Maximum number of resident layout profiles */
+#define MAX_TCO_PROFILES 8
+
+/* Name of the profile filled by tco_loadcontrols */
+#define TCO_DEFAULT_PROFILE "default"
+
+/* Capacity of the action queue, a power of two */
+#define TCO_ACTION_QUEUE_SIZE 256
+
+/* Damaged rectangles a window keeps before they are merged */
+#define TCO_MAX_DIRTY_RECTS 4
+
+/* Size of a layout arena block, larger requests get a block of their own */
+#define TCO_ARENA_BLOCK_SIZE 4096
+
+/* Uniform hit-test grid, 64 pixel cells covering 2048x2048. Controls
+ * beyond it are clamped into the edge cells. */
+#define TCO_GRID_CELL_SHIFT 6
+#define TCO_GRID_COLUMNS    32
+#define TCO_GRID_ROWS       32
+
+/* Points of a touch area acceleration table */
+#define TCO_ACCEL_TABLE_SIZE 8
+
+/* Samples a motion predictor fits, a power of two */
+#define TCO_PREDICT_SAMPLES 8
+
+/* Oldest sample age used by the motion predictor, nanoseconds */
+#define TCO_PREDICT_WINDOW 100000000LL
+
+/* Contacts a gesture control tracks at once */
+#define TCO_GESTURE_MAX_TOUCHES 4
+
+/* Rotation in degrees before a rotate gesture begins */
+#define TCO_GESTURE_ROTATE_SLOP 10.0f
+
+/* Travel in millimeters of a swipe, unless a gesture sets its own */
+#define TCO_GESTURE_SWIPE_DISTANCE 4.0f
+
+/* Touch ids below this are handled, one bit each in the rejected set */
+#define TCO_MAX_TOUCH_IDS 64
+
+/* Alpha steps of the inactivity fade */
+#define TCO_IDLE_FADE_STEPS 8
+
+/* Layers a control can belong to */
+#define TCO_MAX_LAYERS 32
+
+/* Last event of a contact */
+struct tco_touch_sequence {
+    int       m_sequenceId;
+    long long m_timestamp;
+};
+
+/* Pending deadlines, a few per control plus the context's own */
+#define TCO_MAX_TIMERS (MAX_TCO_CONTROLS * 4)
+
 /* Logging */
 #define DEBUGLOG(message, ...) fprintf(stderr, "%s(%s@%d): " message "\n", __FILE__, __FUNCTION__, __LINE__, ##__VA_ARGS__);
 
@@ -25,9 +93,12 @@ typedef int (*HandleTouchFunc)(int dx, int dy);
 typedef int (*HandleMouseButtonFunc)(int button, int mask, int event);
 typedef int (*HandleTapFunc)();
 typedef int (*HandleTouchScreenFunc)(int x, int y, int tap, int hold);
+typedef int (*HandleAnalogFunc)(int x, int y, int magnitude, int event);
+typedef int (*HandleGestureFunc)(int gesture, int a, int b, int event);
 
 const static int TAP_THRESHOLD = 150000000L;
 const static int JITTER_THRESHOLD = 10;
+const static int SWIPE_THRESHOLD = 50; /* pixels, while the display DPI is unknown */
 
 /* Control types enumeration */
 typedef enum {
@@ -35,17 +106,123 @@ typedef enum {
     DPAD,         /* Provides angle and magnitude from center (0 east, 90 north, 180 west, 270 south) */
     TOUCHAREA,    /* Used to provide relative mouse motion */
     MOUSEBUTTON,  /* Used to provide mouse button state */
-    TOUCHSCREEN   /* Provides: mouse move, left click tap and right click tap-hold */
+    TOUCHSCREEN,  /* Provides: mouse move, left click tap and right click tap-hold */
+    ANALOG,       /* Provides x, y and magnitude of the deflection from center */
+    GESTURE       /* Provides pinch, rotate, two finger pan and swipe */
 } tco_control_type;
 
+/* Touch area acceleration profiles */
+typedef enum {
+    TCO_ACCEL_NONE,   /* raw deltas */
+    TCO_ACCEL_LINEAR, /* constant gain */
+    TCO_ACCEL_POWER,  /* gain * (speed / reference) ^ (exponent - 1) */
+    TCO_ACCEL_TABLE   /* gain interpolated from speed, gain points */
+} tco_accel_type;
+
+/* Memory accounting categories */
+typedef enum {
+    TCO_MEMORY_WINDOW_BUFFERS,
+    TCO_MEMORY_PIXMAPS,
+    TCO_MEMORY_HEAP,
+    TCO_MEMORY_CACHED_IMAGES,
+    TCO_MEMORY_CATEGORIES
+} tco_memory_category;
+
 /* Forward declaration of pointer to structure */
 typedef struct tco_window *               tco_window_t;
 typedef struct tco_label_window *         tco_label_window_t;
 typedef struct tco_configuration_window * tco_configuration_window_t;
 typedef struct tco_label *                tco_label_t;
 typedef struct tco_control *              tco_control_t;
+typedef struct tco_control_hot *          tco_control_hot_t;
+typedef struct tco_profile *              tco_profile_t;
 typedef struct png_reader *               png_reader_t;
 typedef struct touch_owner *              touch_owner_t;
+typedef struct tco_action_queue *         tco_action_queue_t;
+typedef struct tco_arena *                tco_arena_t;
+typedef struct tco_arena_block *          tco_arena_block_t;
+typedef struct tco_timer *                tco_timer_t;
+typedef struct tco_predictor *            tco_predictor_t;
+typedef struct tco_filter *               tco_filter_t;
+typedef struct tco_gesture *              tco_gesture_t;
+typedef struct tco_control_track *        tco_control_track_t;
+
+typedef void (*tco_timer_func)(tco_context_t context, tco_timer_t timer, long long now);
+
+/* Recent samples of a contact, for extrapolating its position */
+struct tco_predictor {
+    int       m_x[TCO_PREDICT_SAMPLES];
+    int       m_y[TCO_PREDICT_SAMPLES];
+    long long m_time[TCO_PREDICT_SAMPLES];
+    int       m_count;
+    int       m_next;
+};
+
+/* One-Euro low-pass filter state of a contact, 16.16 fixed point */
+struct tco_filter {
+    int       m_value[2]; /* filtered x, y */
+    long long m_speed[2]; /* filtered pixels per second */
+    long long m_time;
+};
+
+/* Contacts of a gesture control, the first two drive the two finger
+ * gestures */
+struct tco_gesture {
+    int       m_ids[TCO_GESTURE_MAX_TOUCHES];
+    int       m_pos[TCO_GESTURE_MAX_TOUCHES][2];
+    int       m_start[TCO_GESTURE_MAX_TOUCHES][2];
+    long long m_startTime[TCO_GESTURE_MAX_TOUCHES];
+    int       m_count;
+    bool      m_multi;          /* had a second contact since the first landed */
+
+    /* Two finger baseline and the last values sent */
+    float     m_baseDistance;
+    float     m_baseAngle;
+    int       m_baseCenter[2];
+    int       m_lastCenter[2];
+    int       m_scale;          /* 16.16 */
+    int       m_rotation;       /* degrees, 16.16 */
+    unsigned  m_active;         /* bit per GestureType that has begun */
+};
+
+/* Contact state a control updates on every move, kept apart from the
+ * settings in struct tco_control */
+struct tco_control_track {
+    /* Touch areas and touch screens */
+    struct tco_filter    m_filter;
+    struct tco_predictor m_predictor;
+
+    /* Last position a touch screen reported */
+    int       m_lastReported[2];
+
+    /* Touch area speed estimate, pixels per second */
+    long long m_touchLastTime;
+    int       m_touchSpeed;
+
+    /* Contacts of a gesture area */
+    struct tco_gesture m_gesture;
+} __attribute__((aligned(TCO_CACHE_LINE)));
+
+/* Deadline kept in the context timer heap while armed */
+struct tco_timer {
+    long long      m_deadline; /* nanoseconds, tco_clock_now() */
+    int            m_index;    /* heap slot, -1 when idle */
+    tco_timer_func m_fire;
+    void *         m_data;
+};
+
+/* Arena block, the data follows the header */
+struct tco_arena_block {
+    tco_arena_block_t m_next;
+    size_t            m_size;
+    size_t            m_used;
+};
+
+/* Bump allocator backing all objects of a layout */
+struct tco_arena {
+    tco_context_t     m_context;
+    tco_arena_block_t m_blocks;
+};
 
 struct touch_owner {
     tco_control_t            control;
@@ -59,7 +236,11 @@ struct tco_window {
     screen_window_t m_window;
     screen_window_t m_parent;
     int             m_size[2]; /* width, height */
+    int             m_bufferHeight; /* m_size[1] times the stacked states */
     int             m_alpha; /* 0..255 */
+    size_t          m_bufferBytes;
+    int             m_dirtyRects[TCO_MAX_DIRTY_RECTS * 4]; /* x, y, width, height */
+    int             m_numDirtyRects;
 };
 
 /* TCO label window */
@@ -67,15 +248,18 @@ struct tco_label_window {
     struct tco_window m_baseWindow;
     int               m_offset[2]; /* x, y */
     float             m_scale[2];  /* x, y */
+    int               m_states;    /* images stacked in the buffer, one per state */
 };
 
 /* TCO configuration window */
 struct tco_configuration_window {
     struct tco_window m_background;
     struct tco_window m_foreground;
+    screen_buffer_t   m_foregroundBuffer;
     tco_control_t     m_selected;
     int               m_startPos[2];
     int               m_endPos[2];
+    int               m_dragPos[2]; /* where the control would be without snapping */
 };
 
 /* TCO label */
@@ -85,36 +269,33 @@ struct tco_label {
     int                m_width;
     int                m_height;
     char *             m_image_file;
+    char *             m_pressed_image_file;
+    int                m_pressedAlpha; /* -1 keeps the alpha */
+    bool               m_pressed;
     tco_control_t      m_control;
     tco_label_window_t m_label_window;
 };
 
-/* TCO control */
-struct tco_control {
-    /* Control type */
-    tco_control_type m_type;
-
-    /* Control id */
-    int m_id;
-
+/* TCO control, the part read by every touch event. Controls of a
+ * profile keep these in one contiguous cache-line aligned array. */
+struct tco_control_hot {
     int m_x;
     int m_y;
     int m_width;
     int m_height;
 
-    /* Control image properties */
-    int m_srcWidth;
-    int m_srcHeight;
-
-    tco_context_t m_context;
-
     int m_touchId;
 
+    /* Control type */
+    tco_control_type m_type;
+
     union {
         struct {
             int m_last_x;
             int m_last_y;
             long long m_touchDownTime;
+            int m_remainder_x; /* 16.16 output not sent yet */
+            int m_remainder_y;
         } touch_area; /* For touch areas */
         struct {
             int m_start_x;
@@ -123,11 +304,80 @@ struct tco_control {
             bool m_touchScreenInMoveEvent;
             bool m_touchScreenInHoldEvent;
         } touch_screen; /* For touch screen */
+        struct {
+            int m_center_x;
+            int m_center_y;
+        } analog; /* For analog */
+        struct {
+            int m_numTouches;
+            int m_maxTouches;
+        } gesture; /* For gesture areas */
     } m_state;
 
+    tco_control_t m_control;
+
+    /* Position in hit-testing order, see tco_profile_rank */
+    int m_rank;
+} __attribute__((aligned(TCO_CACHE_LINE)));
+
+typedef char tco_grid_mask_fits_controls[MAX_TCO_CONTROLS <= 32 ? 1 : -1];
+
+typedef char tco_control_hot_fits_cache_line[sizeof(struct tco_control_hot) == TCO_CACHE_LINE ? 1 : -1];
+
+/* TCO control */
+struct tco_control {
+    tco_control_hot_t m_hot;
+    tco_control_track_t m_track;
+
+    /* Control id */
+    int m_id;
+
+    /* Control image properties */
+    int m_srcWidth;
+    int m_srcHeight;
+
+    tco_context_t m_context;
+
     /* Control label */
     tco_label_t m_label;
 
+    /* Touch screen hold or key repeat deadline of the active contact */
+    struct tco_timer m_timer;
+
+    /* Turbo has sent the up half of the current press */
+    bool m_repeatReleased;
+
+    /* Higher priorities are hit-tested first, m_hot->m_rank is the resulting position */
+    int  m_priority;
+    bool m_passThrough; /* controls below also get the contact */
+
+    /* Group shown and hidden together, see tco_set_layer_visible */
+    int  m_layer;
+
+    /* Tap and hold thresholds as given in the layout, 0 for the defaults */
+    float     m_tapSlopMm;
+    int       m_tapTimeMs;
+    int       m_holdTimeMs;
+
+    /* The same thresholds in event units */
+    int       m_tapSlop; /* pixels, Manhattan distance */
+    long long m_tapTime;
+    long long m_holdTime;
+
+    /* One-Euro filter of touch areas and touch screens, 16.16 fixed point */
+    int               m_filterCutoff; /* Hz at rest, 0 disables */
+    int               m_filterBeta;   /* Hz per pixel per second */
+    int               m_filterDerivativeCutoff;
+
+    /* Motion prediction of touch areas and touch screens */
+    int                  m_predictLead; /* milliseconds, 0 disables */
+
+    /* Last analog output sent, and the newer one held back by the rate limit */
+    int       m_analogSent[3]; /* x, y, magnitude */
+    int       m_analogPending[3];
+    bool      m_analogHasPending;
+    long long m_analogSentTime;
+
     /* Control specific properties */
     union {
         struct {
@@ -135,6 +385,10 @@ struct tco_control {
             int m_modifier;
             int m_scancode;
             int m_unicode;
+            int m_repeatDelay; /* milliseconds before the first repeat */
+            int m_repeatRate;  /* repeats per second, 0 disables */
+            int m_turbo;       /* repeat as up/down pairs */
+            int m_glide;       /* hand the contact to the next control on exit */
         } key; /* KEY properties */
         struct {
             int m_mask;
@@ -142,24 +396,127 @@ struct tco_control {
         } mouse; /* MOUSEBUTTON properties */
         struct {
             int m_tapSensitive;
+            tco_accel_type m_accel;
+            int m_gain;      /* percent */
+            int m_exponent;  /* percent, for the power curve */
+            int m_reference; /* speed where the power curve gives m_gain */
+            int m_velocity;  /* speed is pixels per second instead of per event */
+            int m_tableSize;
+            int m_table[TCO_ACCEL_TABLE_SIZE][2]; /* speed, gain percent */
         } touch; /* TOUCHAREA properties */
+        struct {
+            int m_deadZone;  /* percent of the radius without output */
+            int m_outerZone; /* percent of the radius giving full output */
+            int m_curve;     /* response exponent in percent, 100 is linear */
+            int m_floating;  /* center on the first touch */
+            int m_rate;      /* maximum updates per second, 0 is unlimited */
+        } analog; /* ANALOG properties */
+        struct {
+            float m_swipeDistanceMm; /* 0 for the default */
+            int   m_swipeDistance;   /* pixels */
+            int   m_swipeTime;       /* milliseconds */
+        } gesture; /* GESTURE properties */
 
     } m_properties;
 };
 
+/* Rules of a layout for rejecting palms and other large contacts */
+struct tco_rejection {
+    /* As given in the layout, millimetres and percent, 0 disables a rule */
+    float m_maxSizeMm;
+    int   m_maxAspect;
+    int   m_orientationRange[2]; /* degrees the aspect rule applies to */
+    float m_edgesMm[4];          /* left, top, right, bottom */
+
+    /* In pixels of the display */
+    int   m_maxSize;
+    int   m_edges[4];
+    bool  m_enabled;
+};
+
+/* TCO layout profile */
+struct tco_profile {
+    char *           m_name;
+
+    /* Controls, labels and strings of the layout */
+    struct tco_arena m_arena;
+
+    /* Defined controls, m_hot[i] and m_track[i] belong to m_controls[i] */
+    tco_control_t    m_controls[MAX_TCO_CONTROLS];
+    tco_control_hot_t m_hot;
+    tco_control_track_t m_track;
+    int              m_numControls;
+
+    /* Contacts that never reach the controls */
+    struct tco_rejection m_rejection;
+
+    /* Control indices from the top-most down, see tco_profile_rank */
+    int              m_order[MAX_TCO_CONTROLS];
+    uint32_t         m_passThrough; /* by rank */
+    uint32_t         m_hidden;      /* by rank, controls of hidden layers */
+
+    /* Bit r of a cell is set if the control of rank r overlaps it */
+    uint32_t         m_grid[TCO_GRID_ROWS * TCO_GRID_COLUMNS];
+
+    /* Where to save user control settings*/
+    char *           m_user_control_path;
+};
+
+/* Single producer, single consumer ring of actions. The producer
+ * only writes m_head and the consumer only writes m_tail. */
+struct tco_action_queue {
+    volatile unsigned m_head __attribute__((aligned(TCO_CACHE_LINE)));
+    volatile unsigned m_tail __attribute__((aligned(TCO_CACHE_LINE)));
+    unsigned          m_dropped;
+    struct tco_action m_actions[TCO_ACTION_QUEUE_SIZE];
+};
+
 /* TCO context */
 struct tco_context {
     screen_context_t           m_screenContext;
     tco_configuration_window_t m_configWindow;
 
-    /* Defined controls */
-    tco_control_t *            m_controls;
-    int                        m_numControls;
+    /* Resident layout profiles, m_profile is the active hit-test set */
+    tco_profile_t              m_profiles[MAX_TCO_PROFILES];
+    int                        m_numProfiles;
+    tco_profile_t              m_profile;
+
+    /* Display density, -1 until queried and 0 if unknown */
+    int                        m_dpi;
+    int                        m_displaySize[2];
+
+    /* Contacts classified as palms, by touch id, until they lift */
+    uint64_t                   m_rejectedTouches;
+
+    /* Newest event seen of each contact, by touch id */
+    struct tco_touch_sequence  m_touchSequence[TCO_MAX_TOUCH_IDS];
+    bool                       m_latestWins;
+    long long                  m_maxEventAge;   /* nanoseconds, 0 for no limit */
+    long long                  m_eventDelay;    /* smallest tco_clock_now() minus event timestamp seen */
+    struct tco_event_stats     m_eventStats;
+
+    /* Window the labels were last drawn on */
+    screen_window_t            m_labelParent;
+
+    /* Bit l is set while layer l is hidden */
+    uint32_t                   m_hiddenLayers;
+
+    /* Label windows were changed and wait for a flush */
+    bool                       m_labelsChanged;
+
+    /* Editor drags, see tco_set_editor_grid */
+    int                        m_editorSnap; /* pixels, 0 does not snap */
+    bool                       m_editorNoOverlap;
+
+    /* Memory held per category, the last entry is the total */
+    struct tco_memory_counter  m_memory[TCO_MEMORY_CATEGORIES + 1];
 
     SLIST_HEAD(touch_owners, touch_owner) m_touch_owners;
 
-    /* Where to save user control settings*/
-    char * m_user_control_path;
+    /* A gesture area owns up to TCO_GESTURE_MAX_TOUCHES contact points and
+     * other controls one, the pool never runs dry */
+    struct touch_owner         m_touchOwnerPool[MAX_TCO_CONTROLS * TCO_GESTURE_MAX_TOUCHES];
+    SLIST_HEAD(free_touch_owners, touch_owner) m_freeTouchOwners;
 
     HandleKeyFunc           m_handleKeyFunc;
     HandleDPadFunc          m_handleDPadFunc;
@@ -167,6 +524,28 @@ struct tco_context {
     HandleMouseButtonFunc   m_handleMouseButtonFunc;
     HandleTapFunc           m_handleTapFunc;
     HandleTouchScreenFunc   m_handleTouchScreenFunc;
+    HandleAnalogFunc        m_handleAnalogFunc;
+    HandleGestureFunc       m_handleGestureFunc;
+
+    /* Actions go to m_actionQueue instead of the callbacks */
+    bool                    m_queueActions;
+    int                     m_actionPipe[2]; /* signals queued actions, -1 when unused */
+    struct tco_action_queue m_actionQueue;
+    struct tco_state_block * m_stateBlock; /* m_localState or the shared copy */
+    struct tco_state_block  m_localState;
+    char *                  m_stateShmName;
+
+    /* Min-heap of armed timers ordered by deadline */
+    tco_timer_t             m_timers[TCO_MAX_TIMERS];
+    int                     m_numTimers;
+
+    /* Inactivity policy, the labels fade out m_idleDelay after the last
+     * touch, m_idleStep counts the fade steps taken */
+    long long               m_idleDelay;     /* nanoseconds, 0 disables */
+    long long               m_idleFade;
+    long long               m_lastActivity;
+    int                     m_idleStep;
+    struct tco_timer        m_idleTimer;
 };
 
 struct png_reader {
@@ -181,8 +560,336 @@ struct png_reader {
     int m_width; /* image width */
     int m_height; /* image height */
     int m_stride; /* image line width in buffer */
+    size_t m_dataBytes; /* accounted size of m_data and m_rows */
+    size_t m_pixmapBytes; /* accounted size of the pixmap buffer */
 };
 
+/* Memory accounting functions */
+static
+void tco_memory_add(tco_context_t context,
+                    tco_memory_category category,
+                    size_t bytes)
+{
+    struct tco_memory_counter * counter = &context->m_memory[category];
+    struct tco_memory_counter * total = &context->m_memory[TCO_MEMORY_CATEGORIES];
+    counter->current += bytes;
+    if(counter->current > counter->peak) {
+        counter->peak = counter->current;
+    }
+    total->current += bytes;
+    if(total->current > total->peak) {
+        total->peak = total->current;
+    }
+}
+
+static
+void tco_memory_sub(tco_context_t context,
+                    tco_memory_category category,
+                    size_t bytes)
+{
+    context->m_memory[category].current -= bytes;
+    context->m_memory[TCO_MEMORY_CATEGORIES].current -= bytes;
+}
+
+/* Action functions */
+static
+bool tco_action_queue_empty(tco_action_queue_t queue)
+{
+    __sync_synchronize();
+    return queue->m_head == queue->m_tail;
+}
+
+static
+bool tco_action_queue_push(tco_action_queue_t queue,
+                           const struct tco_action * action,
+                           bool * wasEmpty)
+{
+    unsigned head = queue->m_head;
+    unsigned tail = queue->m_tail;
+    if(head - tail >= TCO_ACTION_QUEUE_SIZE) {
+        /* Consumer is not keeping up */
+        queue->m_dropped++;
+        return false;
+    }
+    queue->m_actions[head & (TCO_ACTION_QUEUE_SIZE - 1)] = *action;
+    /* Publish the record before the new head */
+    __sync_synchronize();
+    queue->m_head = head + 1;
+    /* The consumer may have emptied the queue since tail was read and
+     * drained the wakeups before this head landed. Reading the tail
+     * again after a full barrier pairs with its drain-then-recheck:
+     * either it sees the new head or this sees its final tail. */
+    __sync_synchronize();
+    *wasEmpty = queue->m_tail == head;
+    return true;
+}
+
+static
+int tco_action_queue_pop(tco_action_queue_t queue,
+                         struct tco_action * actions,
+                         int maxActions)
+{
+    unsigned tail = queue->m_tail;
+    unsigned head = queue->m_head;
+    __sync_synchronize();
+    int count = 0;
+    while(tail != head && count < maxActions) {
+        actions[count++] = queue->m_actions[tail & (TCO_ACTION_QUEUE_SIZE - 1)];
+        tail++;
+    }
+    /* Records are copied out before the slots are handed back */
+    __sync_synchronize();
+    queue->m_tail = tail;
+    return count;
+}
+
+/* Input state functions */
+static
+void tco_state_set_bit(unsigned int * bits,
+                       int bit,
+                       bool set)
+{
+    unsigned int mask = 1u << (bit & 31);
+    if(set) {
+        bits[bit >> 5] |= mask;
+    } else {
+        bits[bit >> 5] &= ~mask;
+    }
+}
+
+static
+void tco_context_update_state(tco_context_t ctx,
+                              const struct tco_action * action)
+{
+    struct tco_state_block * block = ctx->m_stateBlock;
+    struct tco_state * state = &block->m_state;
+    tco_state_block_begin(block);
+    switch(action->type) {
+    case TCO_ACTION_KEY:
+        if(action->data.key.sym >= 0 && action->data.key.sym < TCO_STATE_MAX_KEYS) {
+            tco_state_set_bit(state->keys,
+                              action->data.key.sym,
+                              action->event == TCO_KB_DOWN);
+        }
+        break;
+    case TCO_ACTION_DPAD:
+        state->dpad_active = action->event == TCO_KB_DOWN;
+        state->dpad_angle = action->data.dpad.angle;
+        break;
+    case TCO_ACTION_TOUCH:
+        state->touch_dx += action->data.touch.dx;
+        state->touch_dy += action->data.touch.dy;
+        break;
+    case TCO_ACTION_MOUSE_BUTTON:
+        if(action->data.mouse.button >= 0 && action->data.mouse.button < 32) {
+            tco_state_set_bit(&state->mouse_buttons,
+                              action->data.mouse.button,
+                              action->event == TCO_MOUSE_BUTTON_DOWN);
+        }
+        break;
+    case TCO_ACTION_TOUCHSCREEN:
+        state->touchscreen_x = action->data.touchscreen.x;
+        state->touchscreen_y = action->data.touchscreen.y;
+        break;
+    case TCO_ACTION_ANALOG:
+        state->analog_x = action->data.analog.x;
+        state->analog_y = action->data.analog.y;
+        state->analog_magnitude = action->data.analog.magnitude;
+        break;
+    default:
+        break;
+    }
+    tco_state_block_end(block);
+}
+
+static
+void tco_context_emit(tco_context_t ctx,
+                      const struct tco_action * action)
+{
+    tco_context_update_state(ctx, action);
+    if(ctx->m_queueActions) {
+        bool wasEmpty = false;
+        if(tco_action_queue_push(&ctx->m_actionQueue, action, &wasEmpty) &&
+           wasEmpty && ctx->m_actionPipe[1] != -1) {
+            /* One byte per empty to non-empty transition, a full pipe
+             * already wakes the reader */
+            char signal = 0;
+            if(write(ctx->m_actionPipe[1], &signal, 1) == -1 && errno != EAGAIN) {
+                DEBUGLOG("write: %s (%d)", strerror(errno), errno);
+            }
+        }
+        return;
+    }
+    switch(action->type) {
+    case TCO_ACTION_KEY:
+        if(ctx->m_handleKeyFunc) {
+            ctx->m_handleKeyFunc(action->data.key.sym,
+                                 action->data.key.mod,
+                                 action->data.key.scancode,
+                                 action->data.key.unicode,
+                                 action->event);
+        }
+        break;
+    case TCO_ACTION_DPAD:
+        if(ctx->m_handleDPadFunc) {
+            ctx->m_handleDPadFunc(action->data.dpad.angle, action->event);
+        }
+        break;
+    case TCO_ACTION_TOUCH:
+        if(ctx->m_handleTouchFunc) {
+            ctx->m_handleTouchFunc(action->data.touch.dx, action->data.touch.dy);
+        }
+        break;
+    case TCO_ACTION_MOUSE_BUTTON:
+        if(ctx->m_handleMouseButtonFunc) {
+            ctx->m_handleMouseButtonFunc(action->data.mouse.button,
+                                         action->data.mouse.mask,
+                                         action->event);
+        }
+        break;
+    case TCO_ACTION_TAP:
+        if(ctx->m_handleTapFunc) {
+            ctx->m_handleTapFunc();
+        }
+        break;
+    case TCO_ACTION_TOUCHSCREEN:
+        if(ctx->m_handleTouchScreenFunc) {
+            ctx->m_handleTouchScreenFunc(action->data.touchscreen.x,
+                                         action->data.touchscreen.y,
+                                         action->data.touchscreen.tap,
+                                         action->data.touchscreen.hold);
+        }
+        break;
+    case TCO_ACTION_GESTURE:
+        if(ctx->m_handleGestureFunc) {
+            ctx->m_handleGestureFunc(action->data.gesture.gesture,
+                                     action->data.gesture.a,
+                                     action->data.gesture.b,
+                                     action->event);
+        }
+        break;
+    case TCO_ACTION_ANALOG:
+        if(ctx->m_handleAnalogFunc) {
+            ctx->m_handleAnalogFunc(action->data.analog.x,
+                                    action->data.analog.y,
+                                    action->data.analog.magnitude,
+                                    action->event);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static
+void tco_context_emit_key(tco_context_t ctx,
+                          tco_control_t control,
+                          int event)
+{
+    struct tco_action action;
+    action.type = TCO_ACTION_KEY;
+    action.event = event;
+    action.data.key.sym = control->m_properties.key.m_symbol;
+    action.data.key.mod = control->m_properties.key.m_modifier;
+    action.data.key.scancode = control->m_properties.key.m_scancode;
+    action.data.key.unicode = control->m_properties.key.m_unicode;
+    tco_context_emit(ctx, &action);
+}
+
+static
+void tco_context_emit_dpad(tco_context_t ctx,
+                           int angle,
+                           int event)
+{
+    struct tco_action action;
+    action.type = TCO_ACTION_DPAD;
+    action.event = event;
+    action.data.dpad.angle = angle;
+    tco_context_emit(ctx, &action);
+}
+
+static
+void tco_context_emit_touch(tco_context_t ctx,
+                            int dx,
+                            int dy)
+{
+    struct tco_action action;
+    action.type = TCO_ACTION_TOUCH;
+    action.event = 0;
+    action.data.touch.dx = dx;
+    action.data.touch.dy = dy;
+    tco_context_emit(ctx, &action);
+}
+
+static
+void tco_context_emit_mouse_button(tco_context_t ctx,
+                                   tco_control_t control,
+                                   int event)
+{
+    struct tco_action action;
+    action.type = TCO_ACTION_MOUSE_BUTTON;
+    action.event = event;
+    action.data.mouse.button = control->m_properties.mouse.m_button;
+    action.data.mouse.mask = control->m_properties.mouse.m_mask;
+    tco_context_emit(ctx, &action);
+}
+
+static
+void tco_context_emit_tap(tco_context_t ctx)
+{
+    struct tco_action action;
+    action.type = TCO_ACTION_TAP;
+    action.event = 0;
+    tco_context_emit(ctx, &action);
+}
+
+static
+void tco_context_emit_touchscreen(tco_context_t ctx,
+                                  int x,
+                                  int y,
+                                  int tap,
+                                  int hold)
+{
+    struct tco_action action;
+    action.type = TCO_ACTION_TOUCHSCREEN;
+    action.event = 0;
+    action.data.touchscreen.x = x;
+    action.data.touchscreen.y = y;
+    action.data.touchscreen.tap = tap;
+    action.data.touchscreen.hold = hold;
+    tco_context_emit(ctx, &action);
+}
+
+static
+void tco_context_emit_gesture(tco_context_t ctx,
+                              int gesture,
+                              int a,
+                              int b,
+                              int event)
+{
+    struct tco_action action;
+    action.type = TCO_ACTION_GESTURE;
+    action.event = event;
+    action.data.gesture.gesture = gesture;
+    action.data.gesture.a = a;
+    action.data.gesture.b = b;
+    tco_context_emit(ctx, &action);
+}
+
+static
+void tco_context_emit_analog(tco_context_t ctx,
+                             const int output[3],
+                             int event)
+{
+    struct tco_action action;
+    action.type = TCO_ACTION_ANALOG;
+    action.event = event;
+    action.data.analog.x = output[0];
+    action.data.analog.y = output[1];
+    action.data.analog.magnitude = output[2];
+    tco_context_emit(ctx, &action);
+}
+
 /* Utility functions */
 static
 char * tco_read_text_file(const char * fileName)
@@ -236,64 +943,319 @@ char * tco_read_text_file(const char * fileName)
     return buf;
 }
 
-/* JSON functions */
+/* Timer functions */
 static
-int tco_json_get_int(cJSON * object, const char * name)
+void tco_timer_init(tco_timer_t timer,
+                    tco_timer_func fire,
+                    void * data)
 {
-    cJSON * value = cJSON_GetObjectItem(object, name);
-    if (value != NULL && value->type == cJSON_Number) {
-        return value->valueint;
-    } else {
-        DEBUGLOG("Could not get int (%s) from JSON", name);
-    }
-    return 0;
+    timer->m_deadline = 0;
+    timer->m_index = -1;
+    timer->m_fire = fire;
+    timer->m_data = data;
 }
 
 static
-int tco_json_set_int(cJSON * object, const char * name, int value)
+void tco_context_timer_place(tco_context_t ctx,
+                             tco_timer_t timer,
+                             int index)
 {
-    cJSON * p = cJSON_CreateNumber(value);
-    if(p) {
-        cJSON_AddItemToObject(object, name, p);
-        return TCO_SUCCESS;
-    } else {
-        DEBUGLOG("Could not set int (%s) in JSON", name);
-        return TCO_FAILURE;
-    }
+    ctx->m_timers[index] = timer;
+    timer->m_index = index;
 }
 
 static
-const char * tco_json_get_str(cJSON * object, const char * name)
+void tco_context_timer_sift(tco_context_t ctx,
+                            int index)
 {
-    cJSON * value = cJSON_GetObjectItem(object, name);
-    if (value != NULL && value->type == cJSON_String) {
-        return value->valuestring;
-    } else {
-        DEBUGLOG("Could not get str (%s) from JSON", name);
+    tco_timer_t timer = ctx->m_timers[index];
+    /* Up while earlier than the parent */
+    while(index > 0) {
+        int parent = (index - 1) / 2;
+        if(ctx->m_timers[parent]->m_deadline <= timer->m_deadline) {
+            break;
+        }
+        tco_context_timer_place(ctx, ctx->m_timers[parent], index);
+        index = parent;
     }
-    return 0;
+    /* Down while later than the earliest child */
+    for(;;) {
+        int child = index * 2 + 1;
+        if(child >= ctx->m_numTimers) {
+            break;
+        }
+        if(child + 1 < ctx->m_numTimers &&
+           ctx->m_timers[child + 1]->m_deadline < ctx->m_timers[child]->m_deadline) {
+            child++;
+        }
+        if(timer->m_deadline <= ctx->m_timers[child]->m_deadline) {
+            break;
+        }
+        tco_context_timer_place(ctx, ctx->m_timers[child], index);
+        index = child;
+    }
+    tco_context_timer_place(ctx, timer, index);
 }
 
 static
-int tco_json_set_str(cJSON * object, const char * name, const char * value)
+bool tco_context_timer_schedule(tco_context_t ctx,
+                                tco_timer_t timer,
+                                long long deadline)
 {
-    cJSON * p = cJSON_CreateString(value);
-    if(p) {
-        cJSON_AddItemToObject(object, name, p);
-        return TCO_SUCCESS;
-    } else {
-        DEBUGLOG("Could not set str (%s) in JSON", name);
-        return TCO_FAILURE;
+    if(timer->m_index == -1) {
+        if(ctx->m_numTimers == TCO_MAX_TIMERS) {
+            DEBUGLOG("Too many timers");
+            return false;
+        }
+        tco_context_timer_place(ctx, timer, ctx->m_numTimers++);
     }
+    timer->m_deadline = deadline;
+    tco_context_timer_sift(ctx, timer->m_index);
+    return true;
 }
 
-/* PNG reader functions */
 static
-png_reader_t tco_png_reader_alloc(tco_context_t context)
+void tco_context_timer_cancel(tco_context_t ctx,
+                              tco_timer_t timer)
 {
-    png_reader_t png = (png_reader_t)calloc(1, sizeof(struct png_reader));
-    if(png) {
-        png->m_context = context;
+    int index = timer->m_index;
+    if(index == -1) {
+        return;
+    }
+    timer->m_index = -1;
+    ctx->m_numTimers--;
+    if(index != ctx->m_numTimers) {
+        tco_context_timer_place(ctx, ctx->m_timers[ctx->m_numTimers], index);
+        tco_context_timer_sift(ctx, index);
+    }
+}
+
+static
+void tco_context_run_timers(tco_context_t ctx,
+                            long long now)
+{
+    while(ctx->m_numTimers > 0 && ctx->m_timers[0]->m_deadline <= now) {
+        tco_timer_t timer = ctx->m_timers[0];
+        tco_context_timer_cancel(ctx, timer);
+        /* The handler may schedule the timer again */
+        timer->m_fire(ctx, timer, now);
+    }
+}
+
+static
+long long tco_context_next_deadline(tco_context_t ctx)
+{
+    return ctx->m_numTimers > 0 ? ctx->m_timers[0]->m_deadline : -1;
+}
+
+static
+long long tco_clock_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static
+int tco_context_timeout(tco_context_t ctx,
+                        long long now)
+{
+    long long deadline = tco_context_next_deadline(ctx);
+    if(deadline < 0) {
+        return -1;
+    }
+    if(deadline <= now) {
+        return 0;
+    }
+    /* Round up so the deadline has passed when the wait ends */
+    long long ms = (deadline - now + 999999) / 1000000;
+    return ms > INT_MAX ? INT_MAX : (int)ms;
+}
+
+/* Arena functions */
+static
+void * tco_arena_alloc(tco_arena_t arena,
+                       size_t size,
+                       size_t alignment)
+{
+    tco_arena_block_t block = arena->m_blocks;
+    uintptr_t p = 0;
+    if(block) {
+        uintptr_t base = (uintptr_t)(block + 1);
+        p = (base + block->m_used + alignment - 1) & ~(uintptr_t)(alignment - 1);
+        if(p + size > base + block->m_size) {
+            p = 0;
+        }
+    }
+    if(!p) {
+        size_t blockSize = size + alignment > TCO_ARENA_BLOCK_SIZE ? size + alignment : TCO_ARENA_BLOCK_SIZE;
+        block = (tco_arena_block_t)malloc(sizeof(struct tco_arena_block) + blockSize);
+        if(!block) {
+            DEBUGLOG("%s (%d)", strerror(errno), errno);
+            return NULL;
+        }
+        tco_memory_add(arena->m_context,
+                       TCO_MEMORY_HEAP,
+                       sizeof(struct tco_arena_block) + blockSize);
+        block->m_size = blockSize;
+        block->m_used = 0;
+        block->m_next = arena->m_blocks;
+        arena->m_blocks = block;
+        uintptr_t base = (uintptr_t)(block + 1);
+        p = (base + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    }
+    block->m_used = p + size - (uintptr_t)(block + 1);
+    memset((void *)p, 0, size);
+    return (void *)p;
+}
+
+static
+char * tco_arena_strdup(tco_arena_t arena,
+                        const char * str)
+{
+    size_t len = strlen(str) + 1;
+    char * p = (char *)tco_arena_alloc(arena, len, 1);
+    if(p) {
+        memcpy(p, str, len);
+    }
+    return p;
+}
+
+/* Keeps the most recent block for the next layout */
+static
+void tco_arena_reset(tco_arena_t arena)
+{
+    tco_arena_block_t block = arena->m_blocks;
+    if(block) {
+        tco_arena_block_t next = block->m_next;
+        while(next) {
+            tco_arena_block_t p = next;
+            next = next->m_next;
+            tco_memory_sub(arena->m_context,
+                           TCO_MEMORY_HEAP,
+                           sizeof(struct tco_arena_block) + p->m_size);
+            free(p);
+        }
+        block->m_next = NULL;
+        block->m_used = 0;
+    }
+}
+
+static
+void tco_arena_free(tco_arena_t arena)
+{
+    tco_arena_reset(arena);
+    if(arena->m_blocks) {
+        tco_memory_sub(arena->m_context,
+                       TCO_MEMORY_HEAP,
+                       sizeof(struct tco_arena_block) + arena->m_blocks->m_size);
+        free(arena->m_blocks);
+        arena->m_blocks = NULL;
+    }
+}
+
+/* JSON functions */
+static
+int tco_json_get_int(cJSON * object, const char * name)
+{
+    cJSON * value = cJSON_GetObjectItem(object, name);
+    if (value != NULL && value->type == cJSON_Number) {
+        return value->valueint;
+    } else {
+        DEBUGLOG("Could not get int (%s) from JSON", name);
+    }
+    return 0;
+}
+
+static
+int tco_json_get_int_default(cJSON * object, const char * name, int defaultValue)
+{
+    cJSON * value = cJSON_GetObjectItem(object, name);
+    if (value != NULL && value->type == cJSON_Number) {
+        return value->valueint;
+    }
+    return defaultValue;
+}
+
+static
+int tco_json_set_int(cJSON * object, const char * name, int value)
+{
+    cJSON * p = cJSON_CreateNumber(value);
+    if(p) {
+        cJSON_AddItemToObject(object, name, p);
+        return TCO_SUCCESS;
+    } else {
+        DEBUGLOG("Could not set int (%s) in JSON", name);
+        return TCO_FAILURE;
+    }
+}
+
+static
+const char * tco_json_get_str(cJSON * object, const char * name)
+{
+    cJSON * value = cJSON_GetObjectItem(object, name);
+    if (value != NULL && value->type == cJSON_String) {
+        return value->valuestring;
+    } else {
+        DEBUGLOG("Could not get str (%s) from JSON", name);
+    }
+    return 0;
+}
+
+static
+double tco_json_get_double_default(cJSON * object, const char * name, double defaultValue)
+{
+    cJSON * value = cJSON_GetObjectItem(object, name);
+    if (value != NULL && value->type == cJSON_Number) {
+        return value->valuedouble;
+    }
+    return defaultValue;
+}
+
+static
+int tco_json_set_double(cJSON * object, const char * name, double value)
+{
+    cJSON * p = cJSON_CreateNumber(value);
+    if(p) {
+        cJSON_AddItemToObject(object, name, p);
+        return TCO_SUCCESS;
+    } else {
+        DEBUGLOG("Could not set number (%s) in JSON", name);
+        return TCO_FAILURE;
+    }
+}
+
+static
+const char * tco_json_get_str_default(cJSON * object, const char * name, const char * defaultValue)
+{
+    cJSON * value = cJSON_GetObjectItem(object, name);
+    if (value != NULL && value->type == cJSON_String) {
+        return value->valuestring;
+    }
+    return defaultValue;
+}
+
+static
+int tco_json_set_str(cJSON * object, const char * name, const char * value)
+{
+    cJSON * p = cJSON_CreateString(value);
+    if(p) {
+        cJSON_AddItemToObject(object, name, p);
+        return TCO_SUCCESS;
+    } else {
+        DEBUGLOG("Could not set str (%s) in JSON", name);
+        return TCO_FAILURE;
+    }
+}
+
+/* PNG reader functions */
+static
+png_reader_t tco_png_reader_alloc(tco_context_t context)
+{
+    png_reader_t png = (png_reader_t)calloc(1, sizeof(struct png_reader));
+    if(png) {
+        png->m_context = context;
+        tco_memory_add(context, TCO_MEMORY_HEAP, sizeof(struct png_reader));
     }
     return png;
 }
@@ -321,6 +1283,9 @@ void tco_png_reader_free(png_reader_t png)
         }
         free(png->m_rows);
         free(png->m_data);
+        tco_memory_sub(png->m_context, TCO_MEMORY_CACHED_IMAGES, png->m_dataBytes);
+        tco_memory_sub(png->m_context, TCO_MEMORY_PIXMAPS, png->m_pixmapBytes);
+        tco_memory_sub(png->m_context, TCO_MEMORY_HEAP, sizeof(struct png_reader));
         free(png);
     }
 }
@@ -424,6 +1389,8 @@ bool tco_png_reader_read(png_reader_t png, const char * fileName)
             DEBUGLOG("%s (%d)", strerror(errno), errno);
             break;
         }
+        png->m_dataBytes = png->m_width * png->m_height * channels + png->m_height * sizeof(png_bytep);
+        tco_memory_add(png->m_context, TCO_MEMORY_CACHED_IMAGES, png->m_dataBytes);
 
         int i;
         for (i = png->m_height - 1; i >= 0; --i) {
@@ -489,6 +1456,9 @@ bool tco_png_reader_read(png_reader_t png, const char * fileName)
             break;
         }
 
+        png->m_pixmapBytes = realStride * png->m_height;
+        tco_memory_add(png->m_context, TCO_MEMORY_PIXMAPS, png->m_pixmapBytes);
+
         memset(realPixels, 0, realStride * png->m_height * sizeof(unsigned char));
 
         unsigned char * buffer_pixel_row = realPixels;
@@ -504,6 +1474,8 @@ bool tco_png_reader_read(png_reader_t png, const char * fileName)
         png->m_rows = NULL;
         free(png->m_data);
         png->m_data = NULL;
+        tco_memory_sub(png->m_context, TCO_MEMORY_CACHED_IMAGES, png->m_dataBytes);
+        png->m_dataBytes = 0;
 
         result = true;
         break;
@@ -517,19 +1489,23 @@ bool tco_png_reader_read(png_reader_t png, const char * fileName)
 
 static
 bool tco_label_window_initialize_from_png(tco_label_window_t label_window,
-                                          png_reader_t png);
+                                          png_reader_t png,
+                                          int state);
 
 static
-bool tco_label_load_image(tco_context_t context,
-                          tco_label_t label)
+bool tco_label_load_state_image(tco_context_t context,
+                                tco_label_t label,
+                                const char * fileName,
+                                int state)
 {
     bool result = true;
-    if(label->m_image_file!=NULL && label->m_image_file[0]!='\0') {
+    if(fileName!=NULL && fileName[0]!='\0') {
         png_reader_t png = tco_png_reader_alloc(context);
         if(png) {
-            if(tco_png_reader_read(png, label->m_image_file)) {
+            if(tco_png_reader_read(png, fileName)) {
                 result = tco_label_window_initialize_from_png(label->m_label_window,
-                                                              png);
+                                                              png,
+                                                              state);
             } else {
                 result = false;
             }
@@ -541,6 +1517,21 @@ bool tco_label_load_image(tco_context_t context,
     return result;
 }
 
+/* Renders every state of the label once, pressing only moves the viewport */
+static
+bool tco_label_load_image(tco_context_t context,
+                          tco_label_t label)
+{
+    if(!label->m_label_window) {
+        return false;
+    }
+    bool result = tco_label_load_state_image(context, label, label->m_image_file, 0);
+    if(label->m_label_window->m_states > 1) {
+        result = tco_label_load_state_image(context, label, label->m_pressed_image_file, 1) && result;
+    }
+    return result;
+}
+
 static
 bool tco_window_set_parent(tco_window_t window,
                            screen_window_t parent)
@@ -620,6 +1611,7 @@ bool tco_window_init_ex(tco_window_t window,
                         tco_context_t context,
                         int width,
                         int height,
+                        int states,
                         int alpha,
                         screen_window_t parent)
 {
@@ -670,20 +1662,43 @@ bool tco_window_init_ex(tco_window_t window,
         return false;
     }
 
+    /* Images of further states go below the first one, the source
+     * viewport selects which one is shown */
+    int bufferSize[] = {width, height * states};
+    window->m_bufferHeight = bufferSize[1];
     rc = screen_set_window_property_iv(window->m_window,
                                        SCREEN_PROPERTY_BUFFER_SIZE,
-                                       window->m_size);
+                                       bufferSize);
     if (rc) {
         DEBUGLOG("screen: %s (%d)", strerror(errno), errno);
         return false;
     }
 
+    if (states > 1) {
+        rc = screen_set_window_property_iv(window->m_window,
+                                           SCREEN_PROPERTY_SOURCE_SIZE,
+                                           window->m_size);
+        if (rc) {
+            DEBUGLOG("screen: %s (%d)", strerror(errno), errno);
+            return false;
+        }
+    }
+
     rc = screen_create_window_buffers(window->m_window, 1);
     if (rc) {
         DEBUGLOG("screen: %s (%d)", strerror(errno), errno);
         return false;
     }
 
+    screen_buffer_t buffer;
+    unsigned char * pixels;
+    int stride;
+    if (!tco_window_get_pixels(window, &buffer, &pixels, &stride)) {
+        return false;
+    }
+    window->m_bufferBytes = stride * bufferSize[1];
+    tco_memory_add(context, TCO_MEMORY_WINDOW_BUFFERS, window->m_bufferBytes);
+
     if (!tco_window_set_parent(window, parent))
     {
         return false;
@@ -709,6 +1724,7 @@ bool tco_window_init(tco_window_t window,
                              context,
                              window->m_size[0],
                              window->m_size[1],
+                             1,
                              window->m_alpha,
                              parent);
 }
@@ -777,6 +1793,61 @@ bool tco_window_set_alpha(tco_window_t window,
     return true;
 }
 
+static
+void tco_window_invalidate(tco_window_t window,
+                           int x,
+                           int y,
+                           int width,
+                           int height)
+{
+    /* Clip to the buffer, which holds every state of a label */
+    int x2 = min(x + width, window->m_size[0]);
+    int y2 = min(y + height, window->m_bufferHeight);
+    x = max(x, 0);
+    y = max(y, 0);
+    if(x >= x2 || y >= y2) {
+        return;
+    }
+
+    /* Grow the rectangle that overlaps or costs the least extra area */
+    int i;
+    int best = -1;
+    int bestCost = 0;
+    for(i = 0; i < window->m_numDirtyRects; ++i) {
+        int * r = &window->m_dirtyRects[i * 4];
+        int ux = min(r[0], x);
+        int uy = min(r[1], y);
+        int uw = max(r[0] + r[2], x2) - ux;
+        int uh = max(r[1] + r[3], y2) - uy;
+        int cost = uw * uh - r[2] * r[3] - (x2 - x) * (y2 - y);
+        bool overlaps = x < r[0] + r[2] && r[0] < x2 && y < r[1] + r[3] && r[1] < y2;
+        if(overlaps) {
+            cost = 0;
+        }
+        if(best == -1 || cost < bestCost) {
+            best = i;
+            bestCost = cost;
+        }
+    }
+    if(best != -1 && (bestCost <= 0 || window->m_numDirtyRects == TCO_MAX_DIRTY_RECTS)) {
+        int * r = &window->m_dirtyRects[best * 4];
+        int ux = min(r[0], x);
+        int uy = min(r[1], y);
+        r[2] = max(r[0] + r[2], x2) - ux;
+        r[3] = max(r[1] + r[3], y2) - uy;
+        r[0] = ux;
+        r[1] = uy;
+        return;
+    }
+    int * r = &window->m_dirtyRects[window->m_numDirtyRects * 4];
+    r[0] = x;
+    r[1] = y;
+    r[2] = x2 - x;
+    r[3] = y2 - y;
+    window->m_numDirtyRects++;
+}
+
+/* Posts the damaged rectangles, or the whole window if nothing was invalidated */
 static
 bool tco_window_post(tco_window_t window,
                      screen_buffer_t buffer)
@@ -784,8 +1855,15 @@ bool tco_window_post(tco_window_t window,
     if(!window) {
         return false;
     }
-    int dirtyRects[4] = {0, 0, window->m_size[0], window->m_size[1]};
-    int rc = screen_post_window(window->m_window, buffer, 1, dirtyRects, 0);
+    if(window->m_numDirtyRects == 0) {
+        tco_window_invalidate(window, 0, 0, window->m_size[0], window->m_bufferHeight);
+    }
+    int rc = screen_post_window(window->m_window,
+                                buffer,
+                                window->m_numDirtyRects,
+                                window->m_dirtyRects,
+                                0);
+    window->m_numDirtyRects = 0;
     if(rc) {
         DEBUGLOG("screen: %s (%d)", strerror(errno), errno);
         return false;
@@ -805,49 +1883,58 @@ void tco_window_done(tco_window_t window)
             DEBUGLOG("screen: %s (%d)", strerror(errno), errno);
         }
     }
+    if (window->m_bufferBytes) {
+        tco_memory_sub(window->m_context, TCO_MEMORY_WINDOW_BUFFERS, window->m_bufferBytes);
+    }
     memset(window, 0, sizeof(struct tco_window));
 }
 
 static
 tco_label_window_t tco_label_window_alloc(tco_context_t context,
+                                          tco_arena_t arena,
                                           int width,
                                           int height,
+                                          int states,
                                           int alpha)
 {
-    tco_label_window_t window = (tco_label_window_t)calloc(1, sizeof(struct tco_label_window));
+    tco_label_window_t window = (tco_label_window_t)tco_arena_alloc(arena,
+                                                                    sizeof(struct tco_label_window),
+                                                                    sizeof(void *));
+    if(!window) {
+        return NULL;
+    }
     tco_window_t baseWindow = &window->m_baseWindow;
     if(!tco_window_init_ex(baseWindow,
                            context,
                            width,
                            height,
+                           states,
                            alpha,
                            NULL)) {
-        free(window);
+        tco_window_done(baseWindow);
         return NULL;
     }
     if(!tco_window_set_z_order(baseWindow, 6)) {
         tco_window_done(baseWindow);
-        free(window);
         return NULL;
     }
     if(!tco_window_set_touch_sensitivity(baseWindow, 0)) {
         tco_window_done(baseWindow);
-        free(window);
         return NULL;
     }
     window->m_offset[0] = 0;
     window->m_offset[1] = 0;
     window->m_scale[0] = 1.0f;
     window->m_scale[1] = 1.0f;
+    window->m_states = states;
     return window;
 }
 
 static
-void tco_label_window_free(tco_label_window_t window)
+void tco_label_window_done(tco_label_window_t window)
 {
     if(window) {
         tco_window_done(&window->m_baseWindow);
-        free(window);
     }
 }
 
@@ -941,9 +2028,10 @@ bool tco_label_window_show_at(tco_label_window_t window,
 
 static
 bool tco_label_window_initialize_from_png(tco_label_window_t label_window,
-                                          png_reader_t png)
+                                          png_reader_t png,
+                                          int state)
 {
-    if(!label_window) {
+    if(!label_window || state >= label_window->m_states) {
         return false;
     }
     int rc;
@@ -968,7 +2056,12 @@ bool tco_label_window_initialize_from_png(tco_label_window_t label_window,
         return false;
     }
 
+    const int top = state * window->m_size[1];
     const int fill_attribs[] = {
+        SCREEN_BLIT_DESTINATION_X, 0,
+        SCREEN_BLIT_DESTINATION_Y, top,
+        SCREEN_BLIT_DESTINATION_WIDTH, window->m_size[0],
+        SCREEN_BLIT_DESTINATION_HEIGHT, window->m_size[1],
         SCREEN_BLIT_COLOR, 0x0,
         SCREEN_BLIT_END
     };
@@ -986,7 +2079,7 @@ bool tco_label_window_initialize_from_png(tco_label_window_t label_window,
             SCREEN_BLIT_SOURCE_WIDTH, png->m_width,
             SCREEN_BLIT_SOURCE_HEIGHT, png->m_height,
             SCREEN_BLIT_DESTINATION_X, 0,
-            SCREEN_BLIT_DESTINATION_Y, 0,
+            SCREEN_BLIT_DESTINATION_Y, top,
             SCREEN_BLIT_DESTINATION_WIDTH, window->m_size[0],
             SCREEN_BLIT_DESTINATION_HEIGHT, window->m_size[1],
             SCREEN_BLIT_TRANSPARENCY, SCREEN_TRANSPARENCY_SOURCE,
@@ -1002,6 +2095,7 @@ bool tco_label_window_initialize_from_png(tco_label_window_t label_window,
         return false;
     }
 
+    tco_window_invalidate(window, 0, top, window->m_size[0], window->m_size[1]);
     if(!tco_window_post(window, buffer)) {
         return false;
     }
@@ -1012,8 +2106,9 @@ static
 bool tco_set_controls_alpha(tco_context_t context, int alpha)
 {
     int i;
-    for(i = 0; i < context->m_numControls; ++i) {
-        tco_control_t control = context->m_controls[i];
+    tco_profile_t profile = context->m_profile;
+    for(i = 0; i < profile->m_numControls; ++i) {
+        tco_control_t control = profile->m_controls[i];
         if(control != NULL) {
             tco_label_t label = control->m_label;
             if(label != NULL) {
@@ -1060,35 +2155,55 @@ bool tco_configuration_window_draw(tco_configuration_window_t window,
         return false;
     }
 
-    int x;
+    int i;
     int y;
     const unsigned char back_alpha = 0x90;
-    unsigned char c;
-
     const int cell_size = 16;
-    for (y=0; y< window->m_background.m_size[1]; y++) {
-        int t = y & cell_size;
-        int h = y * background_stride;
-        for (x=0; x < window->m_background.m_size[0]; x++) {
-            int p = x * 4;
-            c = ((x & cell_size) ^ t) ? 0xa0 : 0x80;
-            background_pixels[h + p + 0] = c;
-            background_pixels[h + p + 1] = c;
-            background_pixels[h + p + 2] = c;
-            background_pixels[h + p + 3] = back_alpha;
-        }
+    const int width = window->m_background.m_size[0];
+    const int height = window->m_background.m_size[1];
+    const int row_bytes = width * 4;
+
+    /* The checkerboard has two distinct rows, build them once and
+     * copy them down in bands of cell_size rows. Starting half way
+     * into the pattern gives the row of the odd bands. */
+    uint32_t pattern[3 * cell_size];
+    for (i = 0; i < 3 * cell_size; ++i) {
+        unsigned char c = (i & cell_size) ? 0xa0 : 0x80;
+        pattern[i] = tco_pixel_rgba(c, c, c, back_alpha);
+    }
+    tco_pixel_fill_pattern((uint32_t *)background_pixels,
+                           pattern,
+                           2 * cell_size,
+                           width);
+    if (height > cell_size) {
+        tco_pixel_fill_pattern((uint32_t *)(background_pixels + cell_size * background_stride),
+                               pattern + cell_size,
+                               2 * cell_size,
+                               width);
+    }
+    for (y = 0; y < height; y += cell_size) {
+        int band = height - y < cell_size ? height - y : cell_size;
+        int src = (y & cell_size);
+        int first = (y == src) ? y + 1 : y;
+        tco_pixel_replicate_row(background_pixels,
+                                background_stride,
+                                row_bytes,
+                                src,
+                                first,
+                                y + band - first);
     }
 
-    const unsigned char fore_alpha = 0x00;
-    for (y=0; y< window->m_foreground.m_size[1]; y++) {
-        int h = y * foreground_stride;
-        for (x=0; x < window->m_foreground.m_size[0]; x++) {
-            int p = x * 4;
-            foreground_pixels[h + p + 0] = 0;
-            foreground_pixels[h + p + 1] = 0;
-            foreground_pixels[h + p + 2] = 0;
-            foreground_pixels[h + p + 3] = fore_alpha;
-        }
+    /* Foreground is fully transparent */
+    const int fill_attribs[] = {
+        SCREEN_BLIT_COLOR, 0x0,
+        SCREEN_BLIT_END
+    };
+    int rc = screen_fill(window->m_foreground.m_context->m_screenContext,
+                         foreground_buffer,
+                         fill_attribs);
+    if (rc) {
+        DEBUGLOG("screen: %s (%d)", strerror(errno), errno);
+        return false;
     }
 
     if(!tco_window_post(&window->m_background, background_buffer)) {
@@ -1098,6 +2213,7 @@ bool tco_configuration_window_draw(tco_configuration_window_t window,
     if(!tco_window_post(&window->m_foreground, foreground_buffer)) {
         return false;
     }
+    window->m_foregroundBuffer = foreground_buffer;
 
     if(!tco_set_controls_alpha(window->m_background.m_context,
                                (show ? 255 : -1))) {
@@ -1106,17 +2222,26 @@ bool tco_configuration_window_draw(tco_configuration_window_t window,
     return true;
 }
 
+static
+void tco_configuration_window_free(tco_configuration_window_t window);
+
 static
 tco_configuration_window_t tco_configuration_alloc(tco_context_t context,
                                                    screen_window_t parent)
 {
     tco_configuration_window_t window = (tco_configuration_window_t)calloc(1, sizeof(struct tco_configuration_window));
+    if(!window) {
+        return NULL;
+    }
+    tco_memory_add(context, TCO_MEMORY_HEAP, sizeof(struct tco_configuration_window));
     if(!tco_window_init(&window->m_background, context, parent)) {
+        tco_memory_sub(context, TCO_MEMORY_HEAP, sizeof(struct tco_configuration_window));
         free(window);
         return NULL;
     }
     if(!tco_window_init(&window->m_foreground, context, parent)) {
         tco_window_done(&window->m_background);
+        tco_memory_sub(context, TCO_MEMORY_HEAP, sizeof(struct tco_configuration_window));
         free(window);
         return NULL;
     }
@@ -1124,6 +2249,7 @@ tco_configuration_window_t tco_configuration_alloc(tco_context_t context,
     if(!tco_window_set_z_order(&window->m_background, 5)) {
         tco_window_done(&window->m_background);
         tco_window_done(&window->m_foreground);
+        tco_memory_sub(context, TCO_MEMORY_HEAP, sizeof(struct tco_configuration_window));
         free(window);
         return NULL;
     }
@@ -1131,6 +2257,7 @@ tco_configuration_window_t tco_configuration_alloc(tco_context_t context,
     if(!tco_window_set_z_order(&window->m_foreground, 10)) {
         tco_window_done(&window->m_background);
         tco_window_done(&window->m_foreground);
+        tco_memory_sub(context, TCO_MEMORY_HEAP, sizeof(struct tco_configuration_window));
         free(window);
         return NULL;
     }
@@ -1138,6 +2265,7 @@ tco_configuration_window_t tco_configuration_alloc(tco_context_t context,
     if(!tco_window_set_touch_sensitivity(&window->m_background, 0)) {
         tco_window_done(&window->m_background);
         tco_window_done(&window->m_foreground);
+        tco_memory_sub(context, TCO_MEMORY_HEAP, sizeof(struct tco_configuration_window));
         free(window);
         return NULL;
     }
@@ -1145,11 +2273,14 @@ tco_configuration_window_t tco_configuration_alloc(tco_context_t context,
     if(!tco_window_set_touch_sensitivity(&window->m_foreground, 1)) {
         tco_window_done(&window->m_background);
         tco_window_done(&window->m_foreground);
+        tco_memory_sub(context, TCO_MEMORY_HEAP, sizeof(struct tco_configuration_window));
         free(window);
         return NULL;
     }
 
     if(!tco_configuration_window_draw(window, true)) {
+        /* Also puts back the label alpha the draw may have changed */
+        tco_configuration_window_free(window);
         return NULL;
     }
     return window;
@@ -1167,6 +2298,31 @@ bool tco_control_move(tco_control_t control,
                       int max_x,
                       int max_y);
 
+static
+void tco_profile_grid_update(tco_profile_t profile,
+                             tco_control_t control,
+                             const int * oldBounds);
+
+static
+void tco_profile_resolve_move(tco_profile_t profile,
+                              tco_control_t control,
+                              int * position,
+                              int max_x,
+                              int max_y);
+
+/* Posts the foreground over the old and the new bounds of the moved
+ * control, so only the area its label left and entered is composited */
+static
+bool tco_configuration_window_post_move(tco_configuration_window_t window,
+                                        const int * oldBounds)
+{
+    tco_window_t w = &window->m_foreground;
+    tco_control_hot_t hot = window->m_selected->m_hot;
+    tco_window_invalidate(w, oldBounds[0], oldBounds[1], oldBounds[2], oldBounds[3]);
+    tco_window_invalidate(w, hot->m_x, hot->m_y, hot->m_width, hot->m_height);
+    return tco_window_post(w, window->m_foregroundBuffer);
+}
+
 static
 int tco_configuration_window_run(tco_configuration_window_t window,
                                  screen_event_t screen_event)
@@ -1222,6 +2378,8 @@ int tco_configuration_window_run(tco_configuration_window_t window,
                     if(window->m_selected) {
                         window->m_endPos[0] = window->m_startPos[0];
                         window->m_endPos[1] = window->m_startPos[1];
+                        window->m_dragPos[0] = window->m_selected->m_hot->m_x;
+                        window->m_dragPos[1] = window->m_selected->m_hot->m_y;
                     } else {
                         window->m_endPos[0] = window->m_startPos[0] = 0;
                         window->m_endPos[1] = window->m_startPos[1] = 0;
@@ -1274,13 +2432,31 @@ int tco_configuration_window_run(tco_configuration_window_t window,
             (screen_event == NULL && maxDelta != 0)) {
             window->m_startPos[0] = window->m_endPos[0];
             window->m_startPos[1] = window->m_endPos[1];
+            tco_control_hot_t hot = window->m_selected->m_hot;
+            int oldBounds[4] = {hot->m_x, hot->m_y, hot->m_width, hot->m_height};
+            tco_profile_t profile = window->m_background.m_context->m_profile;
+            window->m_dragPos[0] += deltaX;
+            window->m_dragPos[1] += deltaY;
+            int position[2] = {window->m_dragPos[0], window->m_dragPos[1]};
+            tco_profile_resolve_move(profile,
+                                     window->m_selected,
+                                     position,
+                                     window->m_background.m_size[0],
+                                     window->m_background.m_size[1]);
             if(!tco_control_move(window->m_selected,
-                             deltaX,
-                             deltaY,
+                             position[0] - hot->m_x,
+                             position[1] - hot->m_y,
                              window->m_background.m_size[0],
                              window->m_background.m_size[1])) {
                 return TCO_FAILURE;
             }
+            /* The spatial index follows the drag, touches and the next
+             * move see the control where it is now */
+            tco_profile_grid_update(profile, window->m_selected, oldBounds);
+            /* Only the old and the new bounds of the control are posted */
+            if(!tco_configuration_window_post_move(window, oldBounds)) {
+                return TCO_FAILURE;
+            }
         }
     }
 
@@ -1291,9 +2467,11 @@ static
 void tco_configuration_window_free(tco_configuration_window_t window)
 {
     if (window) {
+        tco_context_t context = window->m_background.m_context;
         tco_configuration_window_draw(window, false);
         tco_window_done(&window->m_foreground);
         tco_window_done(&window->m_background);
+        tco_memory_sub(context, TCO_MEMORY_HEAP, sizeof(struct tco_configuration_window));
         free(window);
     }
 }
@@ -1301,39 +2479,93 @@ void tco_configuration_window_free(tco_configuration_window_t window)
 /* Label functions */
 static
 tco_label_t tco_label_alloc(tco_context_t context,
+                            tco_arena_t arena,
                             tco_control_t control,
                             int x,
                             int y,
                             int width,
                             int height,
                             int alpha,
-                            const char * image)
+                            const char * image,
+                            const char * pressedImage,
+                            int pressedAlpha)
 {
-    tco_label_t label = (tco_label_t)calloc(1, sizeof(struct tco_label));
+    tco_label_t label = (tco_label_t)tco_arena_alloc(arena,
+                                                     sizeof(struct tco_label),
+                                                     sizeof(void *));
+    if(!label) {
+        return NULL;
+    }
     label->m_control = control;
     label->m_x = x;
     label->m_y = y;
     label->m_width = width;
     label->m_height = height;
+    label->m_image_file = NULL;
+    label->m_pressed_image_file = NULL;
+    label->m_pressedAlpha = pressedAlpha >= 0 ? min(pressedAlpha, 0xFF) : -1;
+    label->m_pressed = false;
+    bool pressedState = pressedImage != NULL && pressedImage[0] != '\0';
     label->m_label_window = tco_label_window_alloc(context,
+                                                   arena,
                                                    width,
                                                    height,
+                                                   pressedState ? 2 : 1,
                                                    alpha);
+    if(!label->m_label_window) {
+        /* The control goes without a label, the arena takes the memory back */
+        DEBUGLOG("Label window not created");
+        return NULL;
+    }
+    if(pressedState) {
+        label->m_pressed_image_file = tco_arena_strdup(arena, pressedImage);
+    }
     if(image) {
-        label->m_image_file = strdup(image);
+        label->m_image_file = tco_arena_strdup(arena, image);
+    }
+    if(image || pressedState) {
         tco_label_load_image(context, label);
     }
     return label;
 }
 
+/* Switches the label between its images and alphas. Only properties of
+ * the window change, the images were rendered at load. */
+static
+bool tco_label_set_pressed(tco_label_t label,
+                           bool pressed)
+{
+    tco_label_window_t labelWindow = label->m_label_window;
+    if(label->m_pressed == pressed || !labelWindow) {
+        return true;
+    }
+    label->m_pressed = pressed;
+    tco_window_t w = &labelWindow->m_baseWindow;
+    int rc;
+    if(labelWindow->m_states > 1) {
+        int position[] = {0, pressed ? w->m_size[1] : 0};
+        rc = screen_set_window_property_iv(w->m_window,
+                                           SCREEN_PROPERTY_SOURCE_POSITION,
+                                           position);
+        if (rc) {
+            DEBUGLOG("screen: %s (%d)", strerror(errno), errno);
+            return false;
+        }
+    }
+    if(label->m_pressedAlpha >= 0 &&
+       !tco_window_set_alpha(w, pressed ? label->m_pressedAlpha : w->m_alpha)) {
+        return false;
+    }
+    w->m_context->m_labelsChanged = true;
+    return true;
+}
+
 static
-void tco_label_free(tco_label_t label)
+void tco_label_done(tco_label_t label)
 {
     if(label) {
         label->m_control = NULL;
-        tco_label_window_free(label->m_label_window);
-        free(label->m_image_file);
-        free(label);
+        tco_label_window_done(label->m_label_window);
     }
 }
 
@@ -1360,45 +2592,792 @@ bool tco_label_move(tco_label_t label,
 }
 
 static
-tco_control_t tco_control_alloc(tco_context_t context,
-                                int id,
-                                const char * controlType,
-                                int x,
-                                int y,
-                                int width,
-                                int height)
+long long tco_control_repeat_interval(tco_control_t control)
 {
-    tco_control_t control = calloc(1, sizeof(struct tco_control));
-    control->m_context = context;
-    control->m_id = id;
-    if(strcmp(controlType, "key") == 0) {
-        control->m_type = KEY;
-    } else if (strcmp(controlType, "dpad") == 0) {
-        control->m_type = DPAD;
-    } else if (strcmp(controlType, "toucharea") == 0) {
-        control->m_type = TOUCHAREA;
-    } else if (strcmp(controlType, "mousebutton") == 0) {
-        control->m_type = MOUSEBUTTON;
-    } else if (strcmp(controlType, "touchscreen") == 0) {
-        control->m_type = TOUCHSCREEN;
-    } else {
-        control->m_type = -1;
+    long long interval = 1000000000LL / control->m_properties.key.m_repeatRate;
+    /* Turbo spends half the period released */
+    return control->m_properties.key.m_turbo ? interval / 2 : interval;
+}
+
+static
+void tco_control_key_down(tco_control_t control,
+                          tco_context_t context,
+                          long long timestamp)
+{
+    tco_context_emit_key(context, control, TCO_KB_DOWN);
+    control->m_repeatReleased = false;
+    if(control->m_properties.key.m_repeatRate > 0) {
+        long long delay = control->m_properties.key.m_repeatDelay > 0 ?
+                          control->m_properties.key.m_repeatDelay * 1000000LL :
+                          tco_control_repeat_interval(control);
+        tco_context_timer_schedule(context, &control->m_timer, timestamp + delay);
+    }
+}
+
+static
+void tco_control_key_up(tco_control_t control,
+                        tco_context_t context)
+{
+    tco_context_timer_cancel(context, &control->m_timer);
+    if(!control->m_repeatReleased) {
+        tco_context_emit_key(context, control, TCO_KB_UP);
+    }
+    control->m_repeatReleased = false;
+}
+
+static
+void tco_control_repeat_key(tco_control_t control,
+                            tco_context_t context,
+                            long long deadline,
+                            long long now)
+{
+    if(control->m_properties.key.m_turbo && !control->m_repeatReleased) {
+        tco_context_emit_key(context, control, TCO_KB_UP);
+        control->m_repeatReleased = true;
+    } else {
+        tco_context_emit_key(context, control, TCO_KB_DOWN);
+        control->m_repeatReleased = false;
+    }
+    /* Keep the cadence, but do not burst to catch up after a stall */
+    long long interval = tco_control_repeat_interval(control);
+    long long next = deadline + interval;
+    if(next <= now) {
+        next = now + interval;
+    }
+    tco_context_timer_schedule(context, &control->m_timer, next);
+}
+
+static
+void tco_control_hold(tco_control_t control,
+                      tco_context_t context)
+{
+    tco_control_hot_t hot = control->m_hot;
+    if(hot->m_state.touch_screen.m_touchScreenInMoveEvent ||
+       hot->m_state.touch_screen.m_touchScreenInHoldEvent) {
+        return;
+    }
+    /* Contact has stayed within the jitter threshold of where it started */
+    hot->m_state.touch_screen.m_touchScreenInHoldEvent = true;
+    tco_context_emit_touchscreen(context,
+                                 hot->m_state.touch_screen.m_start_x,
+                                 hot->m_state.touch_screen.m_start_y,
+                                 0,
+                                 1);
+}
+
+/* Filter functions */
+
+/* 2 * pi in 16.16 fixed point */
+#define TCO_TWO_PI_Q16 411775LL
+
+/* Smoothing factor of a first order low-pass, alpha = dt / (dt + tau)
+ * with tau = 1 / (2 pi cutoff) */
+static
+long long tco_filter_alpha(long long cutoff,
+                           long long dtUs)
+{
+    long long omega = (TCO_TWO_PI_Q16 * cutoff) >> 16;
+    if(omega <= 0) {
+        return 0;
+    }
+    long long tauUs = (1000000LL << 16) / omega;
+    return (dtUs << 16) / (dtUs + tauUs);
+}
+
+static
+void tco_filter_reset(tco_filter_t filter,
+                      int x,
+                      int y,
+                      long long timestamp)
+{
+    filter->m_value[0] = x * 65536;
+    filter->m_value[1] = y * 65536;
+    filter->m_speed[0] = 0;
+    filter->m_speed[1] = 0;
+    filter->m_time = timestamp;
+}
+
+/* Position to report for a contact, smoothed more the slower it moves */
+static
+void tco_control_filter(tco_control_t control,
+                        int x,
+                        int y,
+                        long long timestamp,
+                        int position[2])
+{
+    tco_filter_t filter = &control->m_track->m_filter;
+    if(control->m_filterCutoff <= 0) {
+        position[0] = x;
+        position[1] = y;
+        return;
+    }
+    long long dtUs = max((timestamp - filter->m_time) / 1000, 1LL);
+    filter->m_time = timestamp;
+    long long derivativeAlpha = tco_filter_alpha(control->m_filterDerivativeCutoff, dtUs);
+    int raw[2] = {x * 65536, y * 65536};
+    int i;
+    for(i = 0; i < 2; ++i) {
+        long long speed = ((long long)raw[i] - filter->m_value[i]) * 1000000LL / dtUs;
+        filter->m_speed[i] += (derivativeAlpha * (speed - filter->m_speed[i])) >> 16;
+        long long cutoff = control->m_filterCutoff +
+                           ((control->m_filterBeta * llabs(filter->m_speed[i])) >> 16);
+        long long alpha = tco_filter_alpha(cutoff, dtUs);
+        filter->m_value[i] += (int)((alpha * ((long long)raw[i] - filter->m_value[i])) >> 16);
+        position[i] = (filter->m_value[i] + 32768) >> 16;
+    }
+}
+
+/* Prediction functions */
+static
+void tco_predictor_reset(tco_predictor_t predictor)
+{
+    predictor->m_count = 0;
+    predictor->m_next = 0;
+}
+
+static
+void tco_predictor_add(tco_predictor_t predictor,
+                       int x,
+                       int y,
+                       long long timestamp)
+{
+    int i = predictor->m_next;
+    predictor->m_x[i] = x;
+    predictor->m_y[i] = y;
+    predictor->m_time[i] = timestamp;
+    predictor->m_next = (i + 1) & (TCO_PREDICT_SAMPLES - 1);
+    if(predictor->m_count < TCO_PREDICT_SAMPLES) {
+        predictor->m_count++;
+    }
+}
+
+/* Extrapolates the newest sample by lead nanoseconds along the least
+ * squares velocity of the recent samples */
+static
+void tco_predictor_predict(tco_predictor_t predictor,
+                           long long lead,
+                           int position[2])
+{
+    int newest = (predictor->m_next - 1) & (TCO_PREDICT_SAMPLES - 1);
+    position[0] = predictor->m_x[newest];
+    position[1] = predictor->m_y[newest];
+
+    /* Times in milliseconds relative to the newest sample */
+    float sumT = 0, sumX = 0, sumY = 0, sumTT = 0, sumTX = 0, sumTY = 0;
+    int n = 0;
+    int k;
+    for(k = 0; k < predictor->m_count; ++k) {
+        int i = (newest - k) & (TCO_PREDICT_SAMPLES - 1);
+        long long age = predictor->m_time[newest] - predictor->m_time[i];
+        if(age > TCO_PREDICT_WINDOW) {
+            break;
+        }
+        float t = -age / 1000000.0f;
+        float x = predictor->m_x[i] - position[0];
+        float y = predictor->m_y[i] - position[1];
+        sumT += t;
+        sumX += x;
+        sumY += y;
+        sumTT += t * t;
+        sumTX += t * x;
+        sumTY += t * y;
+        n++;
+    }
+    float det = n * sumTT - sumT * sumT;
+    if(n < 2 || det < 1.0f) {
+        /* Not enough spread in time to estimate a velocity */
+        return;
+    }
+    float leadMs = lead / 1000000.0f;
+    position[0] += (int)lroundf((n * sumTX - sumT * sumX) / det * leadMs);
+    position[1] += (int)lroundf((n * sumTY - sumT * sumY) / det * leadMs);
+}
+
+/* Position to report for a contact of a predicting control */
+static
+void tco_control_predict(tco_control_t control,
+                         int x,
+                         int y,
+                         long long timestamp,
+                         int position[2])
+{
+    if(control->m_predictLead <= 0) {
+        position[0] = x;
+        position[1] = y;
+        return;
+    }
+    tco_predictor_add(&control->m_track->m_predictor, x, y, timestamp);
+    tco_predictor_predict(&control->m_track->m_predictor,
+                          control->m_predictLead * 1000000LL,
+                          position);
+}
+
+/* Gain of a touch area at the given speed, 16.16 fixed point */
+static
+int tco_control_touch_gain(tco_control_t control,
+                           int speed)
+{
+    float gain = control->m_properties.touch.m_gain / 100.0f;
+    switch(control->m_properties.touch.m_accel) {
+    case TCO_ACCEL_POWER:
+        gain *= powf(max(speed, 1) / (float)control->m_properties.touch.m_reference,
+                     control->m_properties.touch.m_exponent / 100.0f - 1.0f);
+        break;
+    case TCO_ACCEL_TABLE:
+        {
+            int (*table)[2] = control->m_properties.touch.m_table;
+            int n = control->m_properties.touch.m_tableSize;
+            int i = 0;
+            while(i < n && table[i][0] < speed) {
+                i++;
+            }
+            if(i == 0) {
+                gain = table[0][1] / 100.0f;
+            } else if(i == n) {
+                gain = table[n - 1][1] / 100.0f;
+            } else {
+                float t = (speed - table[i - 1][0]) / (float)(table[i][0] - table[i - 1][0]);
+                gain = (table[i - 1][1] + t * (table[i][1] - table[i - 1][1])) / 100.0f;
+            }
+        }
+        break;
+    default:
+        break;
+    }
+    /* Bound the motion a single event can produce */
+    if(gain > 64.0f) {
+        gain = 64.0f;
+    } else if(gain < 0.0f) {
+        gain = 0.0f;
+    }
+    return (int)(gain * 65536.0f);
+}
+
+static
+void tco_control_touch_down(tco_control_t control,
+                            int x,
+                            int y,
+                            long long timestamp)
+{
+    tco_control_hot_t hot = control->m_hot;
+    hot->m_state.touch_area.m_touchDownTime = timestamp;
+    hot->m_state.touch_area.m_last_x = x;
+    hot->m_state.touch_area.m_last_y = y;
+    hot->m_state.touch_area.m_remainder_x = 0;
+    hot->m_state.touch_area.m_remainder_y = 0;
+    control->m_track->m_touchLastTime = timestamp;
+    control->m_track->m_touchSpeed = 0;
+    tco_filter_reset(&control->m_track->m_filter, x, y, timestamp);
+    tco_predictor_reset(&control->m_track->m_predictor);
+    tco_predictor_add(&control->m_track->m_predictor, x, y, timestamp);
+}
+
+/* Sends the motion since the last event, scaled by the acceleration
+ * profile. Fractions are carried over so only whole pixels go out. */
+static
+void tco_control_touch_move(tco_control_t control,
+                            tco_context_t context,
+                            int x,
+                            int y,
+                            long long timestamp)
+{
+    tco_control_hot_t hot = control->m_hot;
+    int dx = x - hot->m_state.touch_area.m_last_x;
+    int dy = y - hot->m_state.touch_area.m_last_y;
+    if (dx == 0 && dy == 0) {
+        return;
+    }
+    hot->m_state.touch_area.m_last_x = x;
+    hot->m_state.touch_area.m_last_y = y;
+    if (control->m_properties.touch.m_accel == TCO_ACCEL_NONE) {
+        tco_context_emit_touch(context, dx, dy);
+        return;
+    }
+
+    int speed = (int)sqrtf((float)(dx * dx + dy * dy));
+    if (control->m_properties.touch.m_velocity) {
+        /* At least 1ms apart, averaged with the previous estimate */
+        long long dt = max(timestamp - control->m_track->m_touchLastTime, 1000000LL);
+        int instant = (int)(speed * 1000000000LL / dt);
+        speed = control->m_track->m_touchSpeed = (control->m_track->m_touchSpeed + instant) / 2;
+        control->m_track->m_touchLastTime = timestamp;
+    }
+
+    int gain = tco_control_touch_gain(control, speed);
+    long long accX = hot->m_state.touch_area.m_remainder_x + (long long)dx * gain;
+    long long accY = hot->m_state.touch_area.m_remainder_y + (long long)dy * gain;
+    int outX = (int)(accX / 65536);
+    int outY = (int)(accY / 65536);
+    hot->m_state.touch_area.m_remainder_x = (int)(accX - outX * 65536LL);
+    hot->m_state.touch_area.m_remainder_y = (int)(accY - outY * 65536LL);
+    if (outX != 0 || outY != 0) {
+        tco_context_emit_touch(context, outX, outY);
+    }
+}
+
+/* Maps the contact position to x, y and magnitude in 16.16 fixed point */
+static
+void tco_control_analog_output(tco_control_t control,
+                               int x,
+                               int y,
+                               int output[3])
+{
+    tco_control_hot_t hot = control->m_hot;
+    float dx = x - hot->m_state.analog.m_center_x;
+    float dy = y - hot->m_state.analog.m_center_y;
+    float radius = min(hot->m_width, hot->m_height) / 2.0f;
+    float distance = sqrtf(dx * dx + dy * dy);
+    float deadZone = control->m_properties.analog.m_deadZone / 100.0f;
+    float outerZone = control->m_properties.analog.m_outerZone / 100.0f;
+    output[0] = output[1] = output[2] = 0;
+    if(radius <= 0 || distance <= deadZone * radius) {
+        return;
+    }
+    float magnitude = (distance / radius - deadZone) / (outerZone - deadZone);
+    if(magnitude > 1.0f) {
+        magnitude = 1.0f;
+    }
+    if(control->m_properties.analog.m_curve != 100) {
+        magnitude = powf(magnitude, control->m_properties.analog.m_curve / 100.0f);
+    }
+    float scale = magnitude * TCO_ANALOG_ONE / distance;
+    output[0] = (int)(dx * scale);
+    output[1] = (int)(dy * scale);
+    output[2] = (int)(magnitude * TCO_ANALOG_ONE);
+}
+
+static
+void tco_control_analog_send(tco_control_t control,
+                             tco_context_t context,
+                             const int output[3],
+                             long long timestamp)
+{
+    memcpy(control->m_analogSent, output, sizeof(control->m_analogSent));
+    control->m_analogSentTime = timestamp;
+    control->m_analogHasPending = false;
+    tco_context_emit_analog(context, output, TCO_KB_DOWN);
+}
+
+static
+void tco_control_analog_down(tco_control_t control,
+                             tco_context_t context,
+                             int x,
+                             int y,
+                             long long timestamp)
+{
+    tco_control_hot_t hot = control->m_hot;
+    if(control->m_properties.analog.m_floating) {
+        hot->m_state.analog.m_center_x = x;
+        hot->m_state.analog.m_center_y = y;
+    } else {
+        hot->m_state.analog.m_center_x = hot->m_x + hot->m_width / 2;
+        hot->m_state.analog.m_center_y = hot->m_y + hot->m_height / 2;
+    }
+    int output[3];
+    tco_control_analog_output(control, x, y, output);
+    tco_control_analog_send(control, context, output, timestamp);
+}
+
+static
+void tco_control_analog_move(tco_control_t control,
+                             tco_context_t context,
+                             int x,
+                             int y,
+                             long long timestamp)
+{
+    int output[3];
+    tco_control_analog_output(control, x, y, output);
+    if(memcmp(output, control->m_analogSent, sizeof(output)) == 0) {
+        /* Back where the last update left it, nothing to send */
+        control->m_analogHasPending = false;
+        tco_context_timer_cancel(context, &control->m_timer);
+        return;
+    }
+    long long interval = control->m_properties.analog.m_rate > 0 ?
+                         1000000000LL / control->m_properties.analog.m_rate : 0;
+    if(timestamp - control->m_analogSentTime >= interval) {
+        tco_context_timer_cancel(context, &control->m_timer);
+        tco_control_analog_send(control, context, output, timestamp);
+        return;
+    }
+    /* Too soon, keep only the newest value until the slot opens */
+    memcpy(control->m_analogPending, output, sizeof(output));
+    if(!control->m_analogHasPending) {
+        control->m_analogHasPending = true;
+        tco_context_timer_schedule(context,
+                                   &control->m_timer,
+                                   control->m_analogSentTime + interval);
     }
-    control->m_x = x;
-    control->m_y = y;
-    control->m_width = width;
-    control->m_height = height;
+}
+
+static
+void tco_control_analog_up(tco_control_t control,
+                           tco_context_t context)
+{
+    static const int center[3] = {0, 0, 0};
+    tco_context_timer_cancel(context, &control->m_timer);
+    control->m_analogHasPending = false;
+    memset(control->m_analogSent, 0, sizeof(control->m_analogSent));
+    tco_context_emit_analog(context, center, TCO_KB_UP);
+}
+
+static
+void tco_control_timer(tco_context_t context,
+                       tco_timer_t timer,
+                       long long now)
+{
+    tco_control_t control = (tco_control_t)timer->m_data;
+    if(control->m_hot->m_touchId == -1) {
+        return;
+    }
+    switch(control->m_hot->m_type) {
+    case KEY:
+        tco_control_repeat_key(control, context, timer->m_deadline, now);
+        break;
+    case TOUCHSCREEN:
+        tco_control_hold(control, context);
+        break;
+    case ANALOG:
+        if(control->m_analogHasPending) {
+            tco_control_analog_send(control, context, control->m_analogPending, now);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static
+tco_control_t tco_control_alloc(tco_context_t context,
+                                tco_arena_t arena,
+                                tco_control_hot_t hot,
+                                tco_control_track_t track,
+                                int id,
+                                const char * controlType,
+                                int x,
+                                int y,
+                                int width,
+                                int height)
+{
+    tco_control_t control = (tco_control_t)tco_arena_alloc(arena,
+                                                           sizeof(struct tco_control),
+                                                           sizeof(long long));
+    if(!control) {
+        return NULL;
+    }
+    memset(hot, 0, sizeof(struct tco_control_hot));
+    memset(track, 0, sizeof(struct tco_control_track));
+    hot->m_control = control;
+    control->m_hot = hot;
+    control->m_track = track;
+    control->m_context = context;
+    control->m_id = id;
+    if(strcmp(controlType, "key") == 0) {
+        hot->m_type = KEY;
+    } else if (strcmp(controlType, "dpad") == 0) {
+        hot->m_type = DPAD;
+    } else if (strcmp(controlType, "toucharea") == 0) {
+        hot->m_type = TOUCHAREA;
+    } else if (strcmp(controlType, "mousebutton") == 0) {
+        hot->m_type = MOUSEBUTTON;
+    } else if (strcmp(controlType, "touchscreen") == 0) {
+        hot->m_type = TOUCHSCREEN;
+    } else if (strcmp(controlType, "analog") == 0) {
+        hot->m_type = ANALOG;
+    } else if (strcmp(controlType, "gesture") == 0) {
+        hot->m_type = GESTURE;
+        hot->m_state.gesture.m_maxTouches = 2;
+    } else {
+        hot->m_type = -1;
+    }
+    hot->m_x = x;
+    hot->m_y = y;
+    hot->m_width = width;
+    hot->m_height = height;
     control->m_srcWidth = width;
     control->m_srcHeight = height;
-    control->m_touchId = -1;
+    hot->m_touchId = -1;
+    control->m_tapSlop = JITTER_THRESHOLD;
+    control->m_tapTime = TAP_THRESHOLD;
+    control->m_holdTime = 2*TAP_THRESHOLD;
+    tco_timer_init(&control->m_timer, tco_control_timer, control);
     return control;
 }
 
 static
-void tco_control_free(tco_control_t control)
+void tco_control_done(tco_control_t control)
+{
+    tco_label_done(control->m_label);
+}
+
+static inline
+bool tco_control_hot_point_inside(tco_control_hot_t hot,
+                                  int x,
+                                  int y)
+{
+    return (x >= hot->m_x &&
+            x <= hot->m_x + hot->m_width &&
+            y >= hot->m_y &&
+            y <= hot->m_y + hot->m_height);
+}
+
+/* Gesture functions */
+static
+void tco_gesture_measure(tco_gesture_t gesture,
+                         float * distance,
+                         float * angle,
+                         int center[2])
+{
+    float dx = gesture->m_pos[1][0] - gesture->m_pos[0][0];
+    float dy = gesture->m_pos[1][1] - gesture->m_pos[0][1];
+    *distance = sqrtf(dx * dx + dy * dy);
+    *angle = atan2f(dy, dx) * 180 / M_PI;
+    center[0] = (gesture->m_pos[0][0] + gesture->m_pos[1][0]) / 2;
+    center[1] = (gesture->m_pos[0][1] + gesture->m_pos[1][1]) / 2;
+}
+
+/* Two finger gestures are measured against the pair as it is now */
+static
+void tco_gesture_baseline(tco_gesture_t gesture)
+{
+    tco_gesture_measure(gesture,
+                        &gesture->m_baseDistance,
+                        &gesture->m_baseAngle,
+                        gesture->m_baseCenter);
+    gesture->m_lastCenter[0] = gesture->m_baseCenter[0];
+    gesture->m_lastCenter[1] = gesture->m_baseCenter[1];
+    gesture->m_scale = 65536;
+    gesture->m_rotation = 0;
+    gesture->m_active = 0;
+}
+
+static
+void tco_control_gesture_end(tco_control_t control,
+                             tco_context_t context)
+{
+    tco_gesture_t gesture = &control->m_track->m_gesture;
+    if(gesture->m_active & (1u << TCO_GESTURE_PINCH)) {
+        tco_context_emit_gesture(context, TCO_GESTURE_PINCH, gesture->m_scale, 0, TCO_GESTURE_END);
+    }
+    if(gesture->m_active & (1u << TCO_GESTURE_ROTATE)) {
+        tco_context_emit_gesture(context, TCO_GESTURE_ROTATE, gesture->m_rotation, 0, TCO_GESTURE_END);
+    }
+    if(gesture->m_active & (1u << TCO_GESTURE_PAN)) {
+        tco_context_emit_gesture(context, TCO_GESTURE_PAN, 0, 0, TCO_GESTURE_END);
+    }
+    gesture->m_active = 0;
+}
+
+/* Begins a two finger gesture once it passes its slop, then sends changes */
+static
+void tco_control_gesture_update(tco_control_t control,
+                                tco_context_t context)
+{
+    tco_gesture_t gesture = &control->m_track->m_gesture;
+    float distance;
+    float angle;
+    int center[2];
+    tco_gesture_measure(gesture, &distance, &angle, center);
+    int slop = control->m_tapSlop;
+
+    if(gesture->m_baseDistance > 0) {
+        int scale = (int)(distance / gesture->m_baseDistance * 65536);
+        if(!(gesture->m_active & (1u << TCO_GESTURE_PINCH))) {
+            if(fabsf(distance - gesture->m_baseDistance) > slop) {
+                gesture->m_active |= 1u << TCO_GESTURE_PINCH;
+                gesture->m_scale = scale;
+                tco_context_emit_gesture(context, TCO_GESTURE_PINCH, scale, 0, TCO_GESTURE_BEGIN);
+            }
+        } else if(scale != gesture->m_scale) {
+            gesture->m_scale = scale;
+            tco_context_emit_gesture(context, TCO_GESTURE_PINCH, scale, 0, TCO_GESTURE_UPDATE);
+        }
+
+        float delta = angle - gesture->m_baseAngle;
+        if(delta > 180) {
+            delta -= 360;
+        } else if(delta < -180) {
+            delta += 360;
+        }
+        int rotation = (int)(delta * 65536);
+        if(!(gesture->m_active & (1u << TCO_GESTURE_ROTATE))) {
+            if(fabsf(delta) > TCO_GESTURE_ROTATE_SLOP) {
+                gesture->m_active |= 1u << TCO_GESTURE_ROTATE;
+                gesture->m_rotation = rotation;
+                tco_context_emit_gesture(context, TCO_GESTURE_ROTATE, rotation, 0, TCO_GESTURE_BEGIN);
+            }
+        } else if(rotation != gesture->m_rotation) {
+            gesture->m_rotation = rotation;
+            tco_context_emit_gesture(context, TCO_GESTURE_ROTATE, rotation, 0, TCO_GESTURE_UPDATE);
+        }
+    }
+
+    int dx = center[0] - gesture->m_lastCenter[0];
+    int dy = center[1] - gesture->m_lastCenter[1];
+    if(!(gesture->m_active & (1u << TCO_GESTURE_PAN))) {
+        if(abs(center[0] - gesture->m_baseCenter[0]) + abs(center[1] - gesture->m_baseCenter[1]) > slop) {
+            gesture->m_active |= 1u << TCO_GESTURE_PAN;
+            gesture->m_lastCenter[0] = center[0];
+            gesture->m_lastCenter[1] = center[1];
+            tco_context_emit_gesture(context, TCO_GESTURE_PAN, dx, dy, TCO_GESTURE_BEGIN);
+        }
+    } else if(dx != 0 || dy != 0) {
+        gesture->m_lastCenter[0] = center[0];
+        gesture->m_lastCenter[1] = center[1];
+        tco_context_emit_gesture(context, TCO_GESTURE_PAN, dx, dy, TCO_GESTURE_UPDATE);
+    }
+}
+
+/* A single contact that travelled far and fast enough is a swipe */
+static
+void tco_control_gesture_swipe(tco_control_t control,
+                               tco_context_t context,
+                               int x,
+                               int y,
+                               long long timestamp)
+{
+    tco_gesture_t gesture = &control->m_track->m_gesture;
+    int dx = x - gesture->m_start[0][0];
+    int dy = y - gesture->m_start[0][1];
+    long long duration = timestamp - gesture->m_startTime[0];
+    int distance = max(abs(dx), abs(dy));
+    if(distance < control->m_properties.gesture.m_swipeDistance ||
+       duration > control->m_properties.gesture.m_swipeTime * 1000000LL) {
+        return;
+    }
+    int direction;
+    if(abs(dx) >= abs(dy)) {
+        direction = dx < 0 ? TCO_SWIPE_LEFT : TCO_SWIPE_RIGHT;
+    } else {
+        direction = dy < 0 ? TCO_SWIPE_UP : TCO_SWIPE_DOWN;
+    }
+    int speed = (int)(distance * 1000000000LL / max(duration, 1LL));
+    tco_context_emit_gesture(context, TCO_GESTURE_SWIPE, direction, speed, TCO_GESTURE_END);
+}
+
+static
+void tco_control_gesture_cancel(tco_control_t control,
+                                tco_context_t context)
 {
-    tco_label_free(control->m_label);
-    free(control);
+    tco_control_gesture_end(control, context);
+    control->m_track->m_gesture.m_count = 0;
+    control->m_hot->m_state.gesture.m_numTouches = 0;
+}
+
+/* Tracks every contact of a gesture area, returns false once a contact
+ * is no longer tracked */
+static
+bool tco_control_gesture_touch(tco_control_t control,
+                               tco_context_t context,
+                               int type,
+                               int touchId,
+                               int x,
+                               int y,
+                               long long timestamp)
+{
+    tco_control_hot_t hot = control->m_hot;
+    tco_gesture_t gesture = &control->m_track->m_gesture;
+    int slot;
+    for(slot = 0; slot < gesture->m_count; ++slot) {
+        if(gesture->m_ids[slot] == touchId) {
+            break;
+        }
+    }
+
+    if(slot == gesture->m_count) {
+        if(type == SCREEN_EVENT_MTOUCH_RELEASE ||
+           gesture->m_count >= hot->m_state.gesture.m_maxTouches ||
+           !tco_control_hot_point_inside(hot, x, y)) {
+            return false;
+        }
+        gesture->m_ids[slot] = touchId;
+        gesture->m_pos[slot][0] = gesture->m_start[slot][0] = x;
+        gesture->m_pos[slot][1] = gesture->m_start[slot][1] = y;
+        gesture->m_startTime[slot] = timestamp;
+        gesture->m_count++;
+        if(gesture->m_count == 1) {
+            gesture->m_multi = false;
+            hot->m_touchId = touchId;
+        } else {
+            gesture->m_multi = true;
+            if(gesture->m_count == 2) {
+                tco_gesture_baseline(gesture);
+            }
+        }
+        hot->m_state.gesture.m_numTouches = gesture->m_count;
+        return true;
+    }
+
+    gesture->m_pos[slot][0] = x;
+    gesture->m_pos[slot][1] = y;
+
+    if(type != SCREEN_EVENT_MTOUCH_RELEASE) {
+        if(slot < 2 && gesture->m_count >= 2) {
+            tco_control_gesture_update(control, context);
+        }
+        return true;
+    }
+
+    if(gesture->m_count == 1 && !gesture->m_multi) {
+        tco_control_gesture_swipe(control, context, x, y, timestamp);
+    }
+    bool pairChanged = slot < 2 && gesture->m_count >= 2;
+    if(pairChanged) {
+        tco_control_gesture_end(control, context);
+    }
+    gesture->m_count--;
+    for(; slot < gesture->m_count; ++slot) {
+        gesture->m_ids[slot] = gesture->m_ids[slot + 1];
+        memcpy(gesture->m_pos[slot], gesture->m_pos[slot + 1], sizeof(gesture->m_pos[slot]));
+        memcpy(gesture->m_start[slot], gesture->m_start[slot + 1], sizeof(gesture->m_start[slot]));
+        gesture->m_startTime[slot] = gesture->m_startTime[slot + 1];
+    }
+    if(pairChanged && gesture->m_count >= 2) {
+        tco_gesture_baseline(gesture);
+    }
+    hot->m_state.gesture.m_numTouches = gesture->m_count;
+    hot->m_touchId = gesture->m_count > 0 ? gesture->m_ids[0] : -1;
+    return false;
+}
+
+static
+void tco_control_cancel_touch(tco_control_t control,
+                              tco_context_t context)
+{
+    if(!control || control->m_hot->m_touchId == -1) {
+        return;
+    }
+    tco_control_hot_t hot = control->m_hot;
+    /* Release whatever the contact point is holding down */
+    switch (hot->m_type)
+    {
+    case KEY:
+        tco_control_key_up(control, context);
+        break;
+    case DPAD:
+        tco_context_emit_dpad(context, 0, TCO_KB_UP);
+        break;
+    case MOUSEBUTTON:
+        tco_context_emit_mouse_button(context, control, TCO_MOUSE_BUTTON_UP);
+        break;
+    case TOUCHSCREEN:
+        tco_context_timer_cancel(context, &control->m_timer);
+        hot->m_state.touch_screen.m_touchScreenInHoldEvent = false;
+        hot->m_state.touch_screen.m_touchScreenInMoveEvent = false;
+        break;
+    case ANALOG:
+        tco_control_analog_up(control, context);
+        break;
+    case GESTURE:
+        tco_control_gesture_cancel(control, context);
+        break;
+    default:
+        break;
+    }
+    hot->m_touchId = -1;
+    if(control->m_label != NULL) {
+        tco_label_set_pressed(control->m_label, false);
+    }
 }
 
 static
@@ -1411,20 +3390,27 @@ bool tco_control_move(tco_control_t control,
     if(!control) {
         return false;
     }
+    tco_control_hot_t hot = control->m_hot;
     if(dx == 0 && dy == 0) {
         return true;
     }
-    control->m_x += dx;
-    control->m_y += dy;
-    if (control->m_x <= 0)
-        control->m_x = 0;
-    if (control->m_y <= 0)
-        control->m_y = 0;
-    if (control->m_x + control->m_width >= max_x)
-        control->m_x = max_x - control->m_width;
-    if (control->m_y + control->m_height >= max_y)
-        control->m_y = max_y - control->m_height;
-    return tco_label_move(control->m_label, control->m_x, control->m_y);
+    hot->m_x += dx;
+    hot->m_y += dy;
+    if (hot->m_x <= 0)
+        hot->m_x = 0;
+    if (hot->m_y <= 0)
+        hot->m_y = 0;
+    if (hot->m_x + hot->m_width >= max_x)
+        hot->m_x = max_x - hot->m_width;
+    if (hot->m_y + hot->m_height >= max_y)
+        hot->m_y = max_y - hot->m_height;
+    return tco_label_move(control->m_label, hot->m_x, hot->m_y);
+}
+
+static inline
+bool tco_control_hidden(tco_control_t control)
+{
+    return (control->m_context->m_hiddenLayers & (1u << control->m_layer)) != 0;
 }
 
 static
@@ -1434,15 +3420,37 @@ bool tco_control_draw_label(tco_control_t control,
     if(!control) {
         return false;
     }
+    if(control->m_label != NULL && tco_control_hidden(control)) {
+        return tco_window_set_visible(&control->m_label->m_label_window->m_baseWindow, false);
+    }
     if(control->m_label!=NULL) {
         return tco_label_draw(control->m_label,
                               window,
-                              control->m_x,
-                              control->m_y);
+                              control->m_hot->m_x,
+                              control->m_hot->m_y);
     }
     return true;
 }
 
+/* Angle in degrees of a point from the center of the control */
+static
+int tco_control_dpad_angle(tco_control_hot_t hot,
+                           int x,
+                           int y)
+{
+    return atan2((y - hot->m_y - hot->m_height / 2.0f),
+                 (x - hot->m_x - hot->m_width / 2.0f)) * 180 / M_PI;
+}
+
+/* A control takes a new contact if it has none, a gesture area until it is full */
+static inline
+bool tco_control_hot_accepts(tco_control_hot_t hot)
+{
+    return hot->m_touchId == -1 ||
+           (hot->m_type == GESTURE &&
+            hot->m_state.gesture.m_numTouches < hot->m_state.gesture.m_maxTouches);
+}
+
 static
 bool tco_control_point_inside(tco_control_t control,
                               int x,
@@ -1451,31 +3459,29 @@ bool tco_control_point_inside(tco_control_t control,
     if(!control) {
         return false;
     }
-    return (x >= control->m_x &&
-            x <= control->m_x + control->m_width &&
-            y >= control->m_y &&
-            y <= control->m_y + control->m_height);
+    return tco_control_hot_point_inside(control->m_hot, x, y);
 }
 
 static
-bool tco_control_handle_touch(tco_control_t control,
-                              tco_context_t context,
-                              int type,
-                              int touchId,
-                              int x,
-                              int y,
-                              long long timestamp)
+bool tco_control_dispatch_touch(tco_control_t control,
+                                tco_context_t context,
+                                int type,
+                                int touchId,
+                                int x,
+                                int y,
+                                long long timestamp)
 {
-    if(!control) {
-        return false;
+    tco_control_hot_t hot = control->m_hot;
+    if (hot->m_type == GESTURE) {
+        return tco_control_gesture_touch(control, context, type, touchId, x, y, timestamp);
     }
-    if (control->m_touchId != -1 &&
-        control->m_touchId != touchId) {
+    if (hot->m_touchId != -1 &&
+        hot->m_touchId != touchId) {
         /*  We have a contact point set and this isn't it. */
         return false;
     }
 
-    if (control->m_touchId == -1) {
+    if (hot->m_touchId == -1) {
         /*  Don't handle orphaned release events. */
         if (type == SCREEN_EVENT_MTOUCH_RELEASE) {
             return false;
@@ -1486,166 +3492,151 @@ bool tco_control_handle_touch(tco_control_t control,
         }
 
         /*  This is a new touch point that we should start handling */
-        control->m_touchId = touchId;
+        hot->m_touchId = touchId;
 
-        switch (control->m_type)
+        switch (hot->m_type)
         {
         case KEY:
-            if(context->m_handleKeyFunc) {
-                context->m_handleKeyFunc(control->m_properties.key.m_symbol,
-                                         control->m_properties.key.m_modifier,
-                                         control->m_properties.key.m_scancode,
-                                         control->m_properties.key.m_unicode,
-                                         TCO_KB_DOWN);
-            }
+            tco_control_key_down(control, context, timestamp);
             break;
         case DPAD:
-            if(context->m_handleDPadFunc) {
-                int angle = atan2((y - control->m_y - control->m_height / 2.0f),
-                                  (x - control->m_x - control->m_width / 2.0f)) * 180 / M_PI;
-                context->m_handleDPadFunc(angle, TCO_KB_DOWN);
-            }
+            tco_context_emit_dpad(context, tco_control_dpad_angle(hot, x, y), TCO_KB_DOWN);
             break;
         case TOUCHAREA:
-            control->m_state.touch_area.m_touchDownTime = timestamp;
-            control->m_state.touch_area.m_last_x = x;
-            control->m_state.touch_area.m_last_y = y;
+            tco_control_touch_down(control, x, y, timestamp);
             break;
         case MOUSEBUTTON:
-            if(context->m_handleMouseButtonFunc) {
-                context->m_handleMouseButtonFunc(control->m_properties.mouse.m_button,
-                                                 control->m_properties.mouse.m_mask,
-                                                 TCO_MOUSE_BUTTON_DOWN);
-            }
+            tco_context_emit_mouse_button(context, control, TCO_MOUSE_BUTTON_DOWN);
             break;
         case TOUCHSCREEN:
-            control->m_state.touch_screen.m_start_x = x;
-            control->m_state.touch_screen.m_start_y = y;
-            control->m_state.touch_screen.m_touchScreenStartTime = timestamp;
+            hot->m_state.touch_screen.m_start_x = x;
+            hot->m_state.touch_screen.m_start_y = y;
+            hot->m_state.touch_screen.m_touchScreenStartTime = timestamp;
+            control->m_track->m_lastReported[0] = x;
+            control->m_track->m_lastReported[1] = y;
+            tco_filter_reset(&control->m_track->m_filter, x, y, timestamp);
+            tco_predictor_reset(&control->m_track->m_predictor);
+            tco_predictor_add(&control->m_track->m_predictor, x, y, timestamp);
+            tco_context_timer_schedule(context,
+                                       &control->m_timer,
+                                       timestamp + control->m_holdTime);
+            break;
+        case ANALOG:
+            tco_control_analog_down(control, context, x, y, timestamp);
             break;
         default:
             break;
         }
     } else {
-        if (!tco_control_point_inside(control, x, y)) {
+        /* An analog stick keeps tracking a thumb that slips off it */
+        if (hot->m_type != ANALOG && !tco_control_point_inside(control, x, y)) {
             /* Act as if we received a key up */
-            switch (control->m_type)
+            switch (hot->m_type)
             {
             case KEY:
-                if(context->m_handleKeyFunc) {
-                    context->m_handleKeyFunc(control->m_properties.key.m_symbol,
-                                             control->m_properties.key.m_modifier,
-                                             control->m_properties.key.m_scancode,
-                                             control->m_properties.key.m_unicode,
-                                             TCO_KB_UP);
-                }
+                tco_control_key_up(control, context);
                 break;
             case DPAD:
-                if(context->m_handleDPadFunc) {
-                    int angle = atan2((y - control->m_y - control->m_height / 2.0f),
-                                      (x - control->m_x - control->m_width / 2.0f)) * 180 / M_PI;
-                    context->m_handleDPadFunc(angle, TCO_KB_UP);
-                }
+                tco_context_emit_dpad(context, tco_control_dpad_angle(hot, x, y), TCO_KB_UP);
                 break;
             case TOUCHAREA:
-                if(context->m_handleTouchFunc){
-                    int dx = x - control->m_state.touch_area.m_last_x;
-                    int dy = y - control->m_state.touch_area.m_last_y;
-                    if (dx != 0 || dy != 0) {
-                        context->m_handleTouchFunc(dx, dy);
-                        control->m_state.touch_area.m_last_x = x;
-                        control->m_state.touch_area.m_last_y = y;
-                    }
-                }
+                tco_control_touch_move(control, context, x, y, timestamp);
                 break;
             case MOUSEBUTTON:
-                if(context->m_handleMouseButtonFunc) {
-                    context->m_handleMouseButtonFunc(control->m_properties.mouse.m_button,
-                                                     control->m_properties.mouse.m_mask,
-                                                     TCO_MOUSE_BUTTON_UP);
-                }
+                tco_context_emit_mouse_button(context, control, TCO_MOUSE_BUTTON_UP);
                 break;
             case TOUCHSCREEN:
-                control->m_state.touch_screen.m_touchScreenInHoldEvent = false;
-                control->m_state.touch_screen.m_touchScreenInMoveEvent = false;
+                tco_context_timer_cancel(context, &control->m_timer);
+                hot->m_state.touch_screen.m_touchScreenInHoldEvent = false;
+                hot->m_state.touch_screen.m_touchScreenInMoveEvent = false;
                 break;
             default:
                 break;
             }
-            control->m_touchId = -1;
+            hot->m_touchId = -1;
             return false;
         }
 
         /* We have had a previous touch point from this contact and this point is in bounds */
-        switch (control->m_type)
+        switch (hot->m_type)
         {
         case KEY:
             if (type == SCREEN_EVENT_MTOUCH_RELEASE)
             {
-                if(context->m_handleKeyFunc) {
-                    context->m_handleKeyFunc(control->m_properties.key.m_symbol,
-                                             control->m_properties.key.m_modifier,
-                                             control->m_properties.key.m_scancode,
-                                             control->m_properties.key.m_unicode,
-                                             TCO_KB_UP);
-                }
+                tco_control_key_up(control, context);
             }
             break;
         case DPAD:
-            if(context->m_handleDPadFunc) {
-                int angle = atan2((y - control->m_y - control->m_height / 2.0f),
-                                  (x - control->m_x - control->m_width / 2.0f)) * 180 / M_PI;
+            {
                 int event = type == SCREEN_EVENT_MTOUCH_RELEASE ? TCO_KB_UP : TCO_KB_DOWN;
-                context->m_handleDPadFunc(angle, event);
+                tco_context_emit_dpad(context, tco_control_dpad_angle(hot, x, y), event);
             }
             break;
         case TOUCHAREA:
-            if(context->m_handleTouchFunc){
-                if (type == SCREEN_EVENT_MTOUCH_RELEASE &&
-                    (timestamp - control->m_state.touch_area.m_touchDownTime) < TAP_THRESHOLD) {
-                    context->m_handleTapFunc();
+            if (type == SCREEN_EVENT_MTOUCH_RELEASE &&
+                (timestamp - hot->m_state.touch_area.m_touchDownTime) < control->m_tapTime) {
+                tco_context_emit_tap(context);
+            } else {
+                if (type == SCREEN_EVENT_MTOUCH_TOUCH) {
+                    hot->m_state.touch_area.m_touchDownTime = timestamp;
+                }
+                if (type == SCREEN_EVENT_MTOUCH_RELEASE) {
+                    /* Settle on where the contact really ended */
+                    tco_control_touch_move(control, context, x, y, timestamp);
                 } else {
-                    if (type == SCREEN_EVENT_MTOUCH_TOUCH) {
-                        control->m_state.touch_area.m_touchDownTime = timestamp;
-                    }
-                    int dx = x - control->m_state.touch_area.m_last_x;
-                    int dy = y - control->m_state.touch_area.m_last_y;
-                    if (dx != 0 || dy != 0) {
-                        context->m_handleTouchFunc(dx, dy);
-                        control->m_state.touch_area.m_last_x = x;
-                        control->m_state.touch_area.m_last_y = y;
-                    }
+                    int filtered[2];
+                    int position[2];
+                    tco_control_filter(control, x, y, timestamp, filtered);
+                    tco_control_predict(control, filtered[0], filtered[1], timestamp, position);
+                    tco_control_touch_move(control, context, position[0], position[1], timestamp);
                 }
             }
             break;
         case MOUSEBUTTON:
             if (type == SCREEN_EVENT_MTOUCH_RELEASE)
             {
-                if(context->m_handleMouseButtonFunc) {
-                    context->m_handleMouseButtonFunc(control->m_properties.mouse.m_button,
-                                                     control->m_properties.mouse.m_mask,
-                                                     TCO_MOUSE_BUTTON_UP);
-                }
+                tco_context_emit_mouse_button(context, control, TCO_MOUSE_BUTTON_UP);
+            }
+            break;
+        case ANALOG:
+            if (type == SCREEN_EVENT_MTOUCH_RELEASE) {
+                tco_control_analog_up(control, context);
+            } else {
+                tco_control_analog_move(control, context, x, y, timestamp);
             }
             break;
         case TOUCHSCREEN:
-            if(context->m_handleTouchScreenFunc) {
-                int distance = abs(x - control->m_state.touch_screen.m_start_x) +
-                               abs(y - control->m_state.touch_screen.m_start_y);
-                if (!control->m_state.touch_screen.m_touchScreenInHoldEvent) {
+            {
+                int filtered[2];
+                int position[2];
+                tco_control_filter(control, x, y, timestamp, filtered);
+                tco_control_predict(control, filtered[0], filtered[1], timestamp, position);
+                /* Taps are judged on the real contact, moves on the filtered one */
+                int distance = abs(x - hot->m_state.touch_screen.m_start_x) +
+                               abs(y - hot->m_state.touch_screen.m_start_y);
+                int moved = abs(filtered[0] - hot->m_state.touch_screen.m_start_x) +
+                            abs(filtered[1] - hot->m_state.touch_screen.m_start_y);
+                if (!hot->m_state.touch_screen.m_touchScreenInHoldEvent) {
                     if ((type == SCREEN_EVENT_MTOUCH_RELEASE) &&
-                        (timestamp - control->m_state.touch_screen.m_touchScreenStartTime) < TAP_THRESHOLD &&
-                        distance < JITTER_THRESHOLD) {
-                        context->m_handleTouchScreenFunc(x, y, 1, 0);
+                        (timestamp - hot->m_state.touch_screen.m_touchScreenStartTime) < control->m_tapTime &&
+                        distance < control->m_tapSlop) {
+                        tco_context_emit_touchscreen(context, x, y, 1, 0);
                     } else if ((type == SCREEN_EVENT_MTOUCH_MOVE) &&
-                               (control->m_state.touch_screen.m_touchScreenInMoveEvent || (distance > JITTER_THRESHOLD))) {
-                        control->m_state.touch_screen.m_touchScreenInMoveEvent = true;
-                        context->m_handleTouchScreenFunc(x, y, 0, 0);
+                               (hot->m_state.touch_screen.m_touchScreenInMoveEvent || (moved > control->m_tapSlop))) {
+                        hot->m_state.touch_screen.m_touchScreenInMoveEvent = true;
+                        tco_context_timer_cancel(context, &control->m_timer);
+                        if (position[0] != control->m_track->m_lastReported[0] ||
+                            position[1] != control->m_track->m_lastReported[1]) {
+                            control->m_track->m_lastReported[0] = position[0];
+                            control->m_track->m_lastReported[1] = position[1];
+                            tco_context_emit_touchscreen(context, position[0], position[1], 0, 0);
+                        }
                     } else if ((type == SCREEN_EVENT_MTOUCH_MOVE) &&
-                               (!control->m_state.touch_screen.m_touchScreenInMoveEvent) &&
-                               (timestamp - control->m_state.touch_screen.m_touchScreenStartTime) > 2*TAP_THRESHOLD) {
-                        control->m_state.touch_screen.m_touchScreenInHoldEvent = true;
-                        context->m_handleTouchScreenFunc(x, y, 0, 1);
+                               (!hot->m_state.touch_screen.m_touchScreenInMoveEvent) &&
+                               (timestamp - hot->m_state.touch_screen.m_touchScreenStartTime) > control->m_holdTime) {
+                        hot->m_state.touch_screen.m_touchScreenInHoldEvent = true;
+                        tco_context_timer_cancel(context, &control->m_timer);
+                        tco_context_emit_touchscreen(context, x, y, 0, 1);
                     }
                 }
             }
@@ -1654,22 +3645,605 @@ bool tco_control_handle_touch(tco_control_t control,
             break;
         }
 
-        if (type == SCREEN_EVENT_MTOUCH_RELEASE) {
-            control->m_touchId = -1;
-            control->m_state.touch_screen.m_touchScreenInHoldEvent = false;
-            control->m_state.touch_screen.m_touchScreenInMoveEvent = false;
-            return false;
-        }
+        if (type == SCREEN_EVENT_MTOUCH_RELEASE) {
+            tco_context_timer_cancel(context, &control->m_timer);
+            hot->m_touchId = -1;
+            /* The state of the other types shares the union */
+            if (hot->m_type == TOUCHSCREEN) {
+                hot->m_state.touch_screen.m_touchScreenInHoldEvent = false;
+                hot->m_state.touch_screen.m_touchScreenInMoveEvent = false;
+            }
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static inline
+bool tco_control_active(tco_control_hot_t hot)
+{
+    return hot->m_touchId != -1 ||
+           (hot->m_type == GESTURE && hot->m_state.gesture.m_numTouches > 0);
+}
+
+static
+bool tco_control_handle_touch(tco_control_t control,
+                              tco_context_t context,
+                              int type,
+                              int touchId,
+                              int x,
+                              int y,
+                              long long timestamp)
+{
+    if(!control) {
+        return false;
+    }
+    bool handled = tco_control_dispatch_touch(control, context, type, touchId, x, y, timestamp);
+    if(control->m_label != NULL) {
+        tco_label_set_pressed(control->m_label, tco_control_active(control->m_hot));
+    }
+    return handled;
+}
+
+/* Profile functions */
+static
+tco_profile_t tco_profile_alloc(tco_context_t context,
+                                const char * name)
+{
+    tco_profile_t profile = (tco_profile_t)calloc(1, sizeof(struct tco_profile));
+    if(!profile) {
+        return NULL;
+    }
+    profile->m_name = strdup(name);
+    if(!profile->m_name) {
+        free(profile);
+        return NULL;
+    }
+    profile->m_arena.m_context = context;
+    tco_memory_add(context, TCO_MEMORY_HEAP, sizeof(struct tco_profile) + strlen(name) + 1);
+    return profile;
+}
+
+/* Drops the layout, the memory is given back to the arena at once */
+static
+void tco_profile_clear(tco_profile_t profile)
+{
+    int i;
+    for (i = 0; i < profile->m_numControls; ++i)
+    {
+        tco_control_done(profile->m_controls[i]);
+        profile->m_controls[i] = NULL;
+    }
+    profile->m_numControls = 0;
+    profile->m_hot = NULL;
+    profile->m_track = NULL;
+    profile->m_passThrough = 0;
+    profile->m_hidden = 0;
+    memset(profile->m_grid, 0, sizeof(profile->m_grid));
+    profile->m_user_control_path = NULL;
+    tco_arena_reset(&profile->m_arena);
+}
+
+static
+void tco_profile_free(tco_profile_t profile)
+{
+    if(!profile) {
+        return;
+    }
+    tco_profile_clear(profile);
+    tco_arena_free(&profile->m_arena);
+    tco_memory_sub(profile->m_arena.m_context,
+                   TCO_MEMORY_HEAP,
+                   sizeof(struct tco_profile) + strlen(profile->m_name) + 1);
+    free(profile->m_name);
+    free(profile);
+}
+
+static
+int tco_grid_cell(int coordinate,
+                  int count)
+{
+    if(coordinate < 0) {
+        return 0;
+    }
+    coordinate >>= TCO_GRID_CELL_SHIFT;
+    return coordinate < count ? coordinate : count - 1;
+}
+
+/* Orders the controls by priority, ties keep the layout order. The
+ * grid is indexed by rank, so hit-testing meets the top-most control
+ * first without looking at priorities. */
+static
+void tco_profile_rank(tco_profile_t profile)
+{
+    int i, j;
+    for(i = 0; i < profile->m_numControls; ++i) {
+        int priority = profile->m_controls[i]->m_priority;
+        for(j = i; j > 0 && profile->m_controls[profile->m_order[j - 1]]->m_priority < priority; --j) {
+            profile->m_order[j] = profile->m_order[j - 1];
+        }
+        profile->m_order[j] = i;
+    }
+    profile->m_passThrough = 0;
+    for(i = 0; i < profile->m_numControls; ++i) {
+        tco_control_t control = profile->m_controls[profile->m_order[i]];
+        control->m_hot->m_rank = i;
+        if(control->m_passThrough) {
+            profile->m_passThrough |= 1u << i;
+        }
+    }
+}
+
+static
+void tco_profile_update_hidden(tco_profile_t profile,
+                               uint32_t hiddenLayers)
+{
+    profile->m_hidden = 0;
+    int i;
+    for(i = 0; i < profile->m_numControls; ++i) {
+        tco_control_t control = profile->m_controls[i];
+        if(hiddenLayers & (1u << control->m_layer)) {
+            profile->m_hidden |= 1u << control->m_hot->m_rank;
+        }
+    }
+}
+
+/* Sets or clears the bit of the control of rank in the cells of a
+ * rectangle. Hit-testing takes the right and bottom edges as inside,
+ * so the cells holding them are marked too. */
+static
+void tco_profile_grid_mark(tco_profile_t profile,
+                           int rank,
+                           const int * bounds,
+                           bool set)
+{
+    if(bounds[2] < 0 || bounds[3] < 0) {
+        return;
+    }
+    int x0 = tco_grid_cell(bounds[0], TCO_GRID_COLUMNS);
+    int x1 = tco_grid_cell(bounds[0] + bounds[2], TCO_GRID_COLUMNS);
+    int y0 = tco_grid_cell(bounds[1], TCO_GRID_ROWS);
+    int y1 = tco_grid_cell(bounds[1] + bounds[3], TCO_GRID_ROWS);
+    uint32_t bit = 1u << rank;
+    int x, y;
+    for(y = y0; y <= y1; ++y) {
+        for(x = x0; x <= x1; ++x) {
+            if(set) {
+                profile->m_grid[y * TCO_GRID_COLUMNS + x] |= bit;
+            } else {
+                profile->m_grid[y * TCO_GRID_COLUMNS + x] &= ~bit;
+            }
+        }
+    }
+}
+
+static
+void tco_profile_grid_rebuild(tco_profile_t profile)
+{
+    memset(profile->m_grid, 0, sizeof(profile->m_grid));
+    int i;
+    for(i = 0; i < profile->m_numControls; ++i) {
+        tco_control_hot_t hot = &profile->m_hot[profile->m_order[i]];
+        int bounds[4] = {hot->m_x, hot->m_y, hot->m_width, hot->m_height};
+        tco_profile_grid_mark(profile, i, bounds, true);
+    }
+}
+
+/* Moves a control in the grid, only the cells of its old and new bounds are touched */
+static
+void tco_profile_grid_update(tco_profile_t profile,
+                             tco_control_t control,
+                             const int * oldBounds)
+{
+    tco_control_hot_t hot = control->m_hot;
+    int bounds[4] = {hot->m_x, hot->m_y, hot->m_width, hot->m_height};
+    tco_profile_grid_mark(profile, control->m_hot->m_rank, oldBounds, false);
+    tco_profile_grid_mark(profile, control->m_hot->m_rank, bounds, true);
+}
+
+/* Controls that may overlap a rectangle */
+static
+uint32_t tco_profile_grid_rect_mask(tco_profile_t profile,
+                                    const int * bounds)
+{
+    uint32_t mask = 0;
+    if(bounds[2] <= 0 || bounds[3] <= 0) {
+        return mask;
+    }
+    int x0 = tco_grid_cell(bounds[0], TCO_GRID_COLUMNS);
+    int x1 = tco_grid_cell(bounds[0] + bounds[2] - 1, TCO_GRID_COLUMNS);
+    int y0 = tco_grid_cell(bounds[1], TCO_GRID_ROWS);
+    int y1 = tco_grid_cell(bounds[1] + bounds[3] - 1, TCO_GRID_ROWS);
+    int x, y;
+    for(y = y0; y <= y1; ++y) {
+        for(x = x0; x <= x1; ++x) {
+            mask |= profile->m_grid[y * TCO_GRID_COLUMNS + x];
+        }
+    }
+    return mask;
+}
+
+static inline
+bool tco_rect_intersects(const int * a,
+                         const int * b)
+{
+    return a[0] < b[0] + b[2] && b[0] < a[0] + a[2] &&
+           a[1] < b[1] + b[3] && b[1] < a[1] + a[3];
+}
+
+/* Tells whether the control would cover another one at x, y that it
+ * does not cover already. Only controls sharing a grid cell are tested. */
+static
+bool tco_profile_move_collides(tco_profile_t profile,
+                               tco_control_t control,
+                               int x,
+                               int y)
+{
+    tco_control_hot_t hot = control->m_hot;
+    int current[4] = {hot->m_x, hot->m_y, hot->m_width, hot->m_height};
+    int bounds[4] = {x, y, hot->m_width, hot->m_height};
+    uint32_t mask = tco_profile_grid_rect_mask(profile, bounds) &
+                    ~(profile->m_hidden | (1u << control->m_hot->m_rank));
+    while(mask) {
+        tco_control_hot_t other = &profile->m_hot[profile->m_order[__builtin_ctz(mask)]];
+        mask &= mask - 1;
+        int otherBounds[4] = {other->m_x, other->m_y, other->m_width, other->m_height};
+        if(tco_rect_intersects(bounds, otherBounds) &&
+           !tco_rect_intersects(current, otherBounds)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Turns the position a drag asks for into where the control goes: on
+ * the editor grid, inside the screen and, if overlaps are prevented,
+ * sliding along the controls in the way */
+static
+void tco_profile_resolve_move(tco_profile_t profile,
+                              tco_control_t control,
+                              int * position,
+                              int max_x,
+                              int max_y)
+{
+    tco_context_t ctx = control->m_context;
+    tco_control_hot_t hot = control->m_hot;
+    int snap = ctx->m_editorSnap;
+    int i;
+    for(i = 0; i < 2; ++i) {
+        if(snap > 0) {
+            int p = position[i] + snap / 2;
+            position[i] = p - ((p % snap) + snap) % snap;
+        }
+    }
+    position[0] = max(0, min(position[0], max_x - hot->m_width));
+    position[1] = max(0, min(position[1], max_y - hot->m_height));
+    if(!ctx->m_editorNoOverlap ||
+       !tco_profile_move_collides(profile, control, position[0], position[1])) {
+        return;
+    }
+    if(!tco_profile_move_collides(profile, control, position[0], hot->m_y)) {
+        position[1] = hot->m_y;
+    } else if(!tco_profile_move_collides(profile, control, hot->m_x, position[1])) {
+        position[0] = hot->m_x;
+    } else {
+        position[0] = hot->m_x;
+        position[1] = hot->m_y;
+    }
+}
+
+/* Controls that may contain the point, lowest rank first */
+static inline
+uint32_t tco_profile_grid_mask(tco_profile_t profile,
+                               int x,
+                               int y)
+{
+    return profile->m_grid[tco_grid_cell(y, TCO_GRID_ROWS) * TCO_GRID_COLUMNS +
+                           tco_grid_cell(x, TCO_GRID_COLUMNS)];
+}
+
+/* Top-most control without a contact that contains the point */
+static
+int tco_profile_free_control_at(tco_profile_t profile,
+                                int x,
+                                int y)
+{
+    uint32_t mask = tco_profile_grid_mask(profile, x, y) & ~profile->m_hidden;
+    while(mask) {
+        int i = profile->m_order[__builtin_ctz(mask)];
+        mask &= mask - 1;
+        tco_control_hot_t hot = &profile->m_hot[i];
+        if(tco_control_hot_accepts(hot) &&
+           tco_control_hot_point_inside(hot, x, y)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static
+bool tco_profile_set_visible(tco_profile_t profile,
+                             screen_window_t parent,
+                             bool visible)
+{
+    int i;
+    for (i = 0; i < profile->m_numControls; ++i) {
+        tco_control_t control = profile->m_controls[i];
+        if(control->m_label == NULL) {
+            continue;
+        }
+        tco_window_t w = &control->m_label->m_label_window->m_baseWindow;
+        if(visible) {
+            /* Labels of a profile that was never shown still have to join the group */
+            if(!tco_control_draw_label(control, parent) ||
+               !tco_window_set_alpha(w, w->m_alpha)) {
+                return false;
+            }
+        } else if(!tco_window_set_visible(w, false)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* TCO context functions */
+static
+bool tco_context_set_labels_alpha(tco_context_t ctx,
+                                  int step)
+{
+    int i;
+    tco_profile_t profile = ctx->m_profile;
+    for(i = 0; i < profile->m_numControls; ++i) {
+        tco_control_t control = profile->m_controls[i];
+        if(control->m_label == NULL || tco_control_hidden(control)) {
+            continue;
+        }
+        tco_window_t w = &control->m_label->m_label_window->m_baseWindow;
+        int alpha = w->m_alpha * (TCO_IDLE_FADE_STEPS - step) / TCO_IDLE_FADE_STEPS;
+        if(!tco_window_set_alpha(w, alpha)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static
+void tco_context_idle_reset(tco_context_t ctx,
+                            long long now);
+
+/* Touches only move m_lastActivity, a timer that fires early is armed
+ * again for the actual deadline */
+static
+void tco_context_idle_timer(tco_context_t ctx,
+                            tco_timer_t timer,
+                            long long now)
+{
+    if(ctx->m_idleDelay <= 0 || ctx->m_labelParent == NULL) {
+        return;
+    }
+    long long deadline = ctx->m_lastActivity + ctx->m_idleDelay;
+    if(now < deadline) {
+        tco_context_timer_schedule(ctx, timer, deadline);
+        return;
+    }
+    if(ctx->m_configWindow != NULL) {
+        /* Not while the editor is shown */
+        tco_context_idle_reset(ctx, now);
+        tco_context_timer_schedule(ctx, timer, now + ctx->m_idleDelay);
+        return;
+    }
+    int step = ctx->m_idleFade > 0 ? ctx->m_idleStep + 1 : TCO_IDLE_FADE_STEPS;
+    bool done;
+    if(step < TCO_IDLE_FADE_STEPS) {
+        done = tco_context_set_labels_alpha(ctx, step);
+    } else {
+        /* Hidden windows cost the compositor nothing */
+        done = tco_profile_set_visible(ctx->m_profile, ctx->m_labelParent, false);
+    }
+    int rc = screen_flush_context(ctx->m_screenContext, 0);
+    if(rc) {
+        DEBUGLOG("screen: %s (%d)", strerror(errno), errno);
+    }
+    if(!done) {
+        /* Try the same step again rather than stay opaque for good */
+        tco_context_timer_schedule(ctx, timer, now + (ctx->m_idleFade > 0 ?
+                                                      ctx->m_idleFade / TCO_IDLE_FADE_STEPS :
+                                                      ctx->m_idleDelay));
+        return;
+    }
+    ctx->m_idleStep = step;
+    if(step < TCO_IDLE_FADE_STEPS) {
+        tco_context_timer_schedule(ctx, timer, now + ctx->m_idleFade / TCO_IDLE_FADE_STEPS);
+    }
+}
+
+/* Labels were just shown at their own alpha */
+static
+void tco_context_idle_reset(tco_context_t ctx,
+                            long long now)
+{
+    ctx->m_idleStep = 0;
+    ctx->m_lastActivity = now;
+    if(ctx->m_idleDelay > 0 && ctx->m_idleTimer.m_index == -1) {
+        tco_context_timer_schedule(ctx, &ctx->m_idleTimer, now + ctx->m_idleDelay);
+    }
+}
+
+/* Brings faded labels back, the caller flushes */
+static
+bool tco_context_idle_wake(tco_context_t ctx,
+                           long long now)
+{
+    bool done = true;
+    if(ctx->m_idleStep > 0 && ctx->m_labelParent != NULL) {
+        done = ctx->m_idleStep < TCO_IDLE_FADE_STEPS ?
+               tco_context_set_labels_alpha(ctx, 0) :
+               tco_profile_set_visible(ctx->m_profile, ctx->m_labelParent, true);
+    }
+    tco_context_idle_reset(ctx, now);
+    return done;
+}
+
+static
+int tco_context_set_idle_policy(tco_context_t ctx,
+                                int idle_ms,
+                                int fade_ms)
+{
+    if(!ctx || idle_ms < 0 || fade_ms < 0) {
+        errno = EINVAL;
+        return TCO_FAILURE;
+    }
+    ctx->m_idleDelay = idle_ms * 1000000LL;
+    ctx->m_idleFade = fade_ms * 1000000LL;
+    long long now = tco_clock_now();
+    if(!tco_context_idle_wake(ctx, now)) {
+        return TCO_FAILURE;
+    }
+    if(ctx->m_idleDelay > 0) {
+        tco_context_timer_schedule(ctx, &ctx->m_idleTimer, now + ctx->m_idleDelay);
+    } else {
+        tco_context_timer_cancel(ctx, &ctx->m_idleTimer);
+    }
+    if(ctx->m_labelParent != NULL) {
+        int rc = screen_flush_context(ctx->m_screenContext, 0);
+        if(rc) {
+            DEBUGLOG("screen: %s (%d)", strerror(errno), errno);
+            return TCO_FAILURE;
+        }
+    }
+    return TCO_SUCCESS;
+}
+
+static
+tco_control_t tco_context_control_at(tco_context_t ctx,
+                                     int x,
+                                     int y);
+
+static
+tco_profile_t tco_context_find_profile(tco_context_t ctx,
+                                       const char * name)
+{
+    int i;
+    for (i = 0; i < ctx->m_numProfiles; ++i) {
+        if (strcmp(ctx->m_profiles[i]->m_name, name) == 0) {
+            return ctx->m_profiles[i];
+        }
+    }
+    return NULL;
+}
+
+static
+tco_profile_t tco_context_add_profile(tco_context_t ctx,
+                                      const char * name)
+{
+    if(ctx->m_numProfiles >= MAX_TCO_PROFILES) {
+        DEBUGLOG("Too many profiles defined");
+        errno = ENOSPC;
+        return NULL;
     }
+    tco_profile_t profile = tco_profile_alloc(ctx, name);
+    if(profile) {
+        ctx->m_profiles[ctx->m_numProfiles] = profile;
+        ctx->m_numProfiles++;
+    }
+    return profile;
+}
 
-    return true;
+static
+touch_owner_t tco_context_touch_owner_get(tco_context_t ctx)
+{
+    touch_owner_t p = SLIST_FIRST(&ctx->m_freeTouchOwners);
+    if(p) {
+        SLIST_REMOVE_HEAD(&ctx->m_freeTouchOwners, link);
+    }
+    return p;
 }
 
-/* TCO context functions */
 static
-tco_control_t tco_context_control_at(tco_context_t ctx,
-                                     int x,
-                                     int y);
+void tco_context_touch_owner_put(tco_context_t ctx,
+                                 touch_owner_t p)
+{
+    p->control = NULL;
+    p->touch_id = -1;
+    SLIST_INSERT_HEAD(&ctx->m_freeTouchOwners, p, link);
+}
+
+static
+void tco_context_release_touches(tco_context_t ctx)
+{
+    touch_owner_t p;
+    while(!SLIST_EMPTY(&ctx->m_touch_owners)) {
+        p = SLIST_FIRST(&ctx->m_touch_owners);
+        SLIST_REMOVE_HEAD(&ctx->m_touch_owners, link);
+        tco_control_cancel_touch(p->control, ctx);
+        tco_context_touch_owner_put(ctx, p);
+    }
+}
+
+static
+void tco_context_unpublish_state(tco_context_t ctx)
+{
+    if(ctx->m_stateBlock == &ctx->m_localState) {
+        return;
+    }
+    struct tco_state_block * block = ctx->m_stateBlock;
+    ctx->m_localState.m_state = block->m_state;
+    ctx->m_stateBlock = &ctx->m_localState;
+    munmap(block, sizeof(struct tco_state_block));
+    shm_unlink(ctx->m_stateShmName);
+    free(ctx->m_stateShmName);
+    ctx->m_stateShmName = NULL;
+}
+
+static
+int tco_context_publish_state(tco_context_t ctx,
+                              const char * name)
+{
+    if(!ctx || !name) {
+        errno = EINVAL;
+        return TCO_FAILURE;
+    }
+    if(ctx->m_stateBlock != &ctx->m_localState) {
+        errno = EBUSY;
+        return TCO_FAILURE;
+    }
+    char * shmName = strdup(name);
+    if(!shmName) {
+        errno = ENOMEM;
+        return TCO_FAILURE;
+    }
+    int fd = shm_open(name, O_RDWR | O_CREAT, 0644);
+    if(fd == -1) {
+        DEBUGLOG("shm_open: %s (%d)", strerror(errno), errno);
+        free(shmName);
+        return TCO_FAILURE;
+    }
+    if(ftruncate(fd, sizeof(struct tco_state_block)) == -1) {
+        DEBUGLOG("ftruncate: %s (%d)", strerror(errno), errno);
+        close(fd);
+        shm_unlink(name);
+        free(shmName);
+        return TCO_FAILURE;
+    }
+    void * addr = mmap(NULL, sizeof(struct tco_state_block),
+                       PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(addr == MAP_FAILED) {
+        DEBUGLOG("mmap: %s (%d)", strerror(errno), errno);
+        shm_unlink(name);
+        free(shmName);
+        return TCO_FAILURE;
+    }
+    struct tco_state_block * block = (struct tco_state_block *)addr;
+    tco_state_block_init(block);
+    block->m_state = ctx->m_localState.m_state;
+    /* Block is complete before the writer switches to it */
+    __sync_synchronize();
+    ctx->m_stateBlock = block;
+    ctx->m_stateShmName = shmName;
+    return TCO_SUCCESS;
+}
 
 static
 tco_context_t tco_context_alloc(screen_context_t screenContext,
@@ -1684,14 +4258,33 @@ tco_context_t tco_context_alloc(screen_context_t screenContext,
     tco_context_t ctx = (tco_context_t) calloc(1, sizeof(struct tco_context));
     if(ctx) {
         ctx->m_screenContext = screenContext;
-        ctx->m_controls = (tco_control_t*) calloc(MAX_TCO_CONTROLS, sizeof(tco_control_t));
+        tco_memory_add(ctx, TCO_MEMORY_HEAP, sizeof(struct tco_context));
         ctx->m_handleKeyFunc = callbacks.handleKeyFunc;
         ctx->m_handleDPadFunc = callbacks.handleDPadFunc;
         ctx->m_handleMouseButtonFunc = callbacks.handleMouseButtonFunc;
         ctx->m_handleTapFunc = callbacks.handleTapFunc;
         ctx->m_handleTouchFunc = callbacks.handleTouchFunc;
         ctx->m_handleTouchScreenFunc = callbacks.handleTouchScreenFunc;
+        ctx->m_handleAnalogFunc = callbacks.handleAnalogFunc;
+        ctx->m_handleGestureFunc = callbacks.handleGestureFunc;
+        tco_state_block_init(&ctx->m_localState);
+        ctx->m_stateBlock = &ctx->m_localState;
+        ctx->m_actionPipe[0] = -1;
+        ctx->m_actionPipe[1] = -1;
+        ctx->m_dpi = -1;
+        tco_timer_init(&ctx->m_idleTimer, tco_context_idle_timer, NULL);
         SLIST_INIT(&ctx->m_touch_owners);
+        SLIST_INIT(&ctx->m_freeTouchOwners);
+        int i;
+        for(i = 0; i < MAX_TCO_CONTROLS * TCO_GESTURE_MAX_TOUCHES; ++i) {
+            tco_context_touch_owner_put(ctx, &ctx->m_touchOwnerPool[i]);
+        }
+        ctx->m_profile = tco_context_add_profile(ctx, TCO_DEFAULT_PROFILE);
+        if(!ctx->m_profile) {
+            free(ctx);
+            ctx = NULL;
+            bps_shutdown();
+        }
     } else {
         bps_shutdown();
     }
@@ -1707,23 +4300,20 @@ void tco_context_free(tco_context_t ctx)
 
     int i;
     tco_configuration_window_free(ctx->m_configWindow);
-    for (i = 0; i < ctx->m_numControls; ++i)
+
+    SLIST_INIT(&ctx->m_touch_owners);
+    for (i = 0; i < ctx->m_numProfiles; ++i)
     {
-        tco_control_free(ctx->m_controls[i]);
+        tco_profile_free(ctx->m_profiles[i]);
     }
+    ctx->m_numProfiles = 0;
+    ctx->m_profile = NULL;
 
-    free(ctx->m_controls);
-    ctx->m_controls = NULL;
-    ctx->m_numControls = 0;
-
-    touch_owner_t p;
-    while(!SLIST_EMPTY(&ctx->m_touch_owners)) {
-        p = SLIST_FIRST(&ctx->m_touch_owners);
-        SLIST_REMOVE_HEAD(&ctx->m_touch_owners, link);
-        free(p);
+    tco_context_unpublish_state(ctx);
+    if(ctx->m_actionPipe[0] != -1) {
+        close(ctx->m_actionPipe[0]);
+        close(ctx->m_actionPipe[1]);
     }
-
-    free(ctx->m_user_control_path);
     free(ctx);
 
     bps_shutdown();
@@ -1731,6 +4321,7 @@ void tco_context_free(tco_context_t ctx)
 
 static
 tco_control_t tco_context_create_control(tco_context_t ctx,
+                                         tco_profile_t profile,
                                          int id,
                                          const char * controlType,
                                          int x,
@@ -1738,24 +4329,306 @@ tco_control_t tco_context_create_control(tco_context_t ctx,
                                          int width,
                                          int height)
 {
-    if(ctx->m_numControls >= MAX_TCO_CONTROLS) {
+    if(profile->m_numControls >= MAX_TCO_CONTROLS) {
         DEBUGLOG("Too many controls defined");
         return NULL;
     }
+    if(!profile->m_hot) {
+        profile->m_hot = (tco_control_hot_t)tco_arena_alloc(&profile->m_arena,
+                                                            MAX_TCO_CONTROLS * sizeof(struct tco_control_hot),
+                                                            TCO_CACHE_LINE);
+        if(!profile->m_hot) {
+            return NULL;
+        }
+    }
+    if(!profile->m_track) {
+        profile->m_track = (tco_control_track_t)tco_arena_alloc(&profile->m_arena,
+                                                                MAX_TCO_CONTROLS * sizeof(struct tco_control_track),
+                                                                TCO_CACHE_LINE);
+        if(!profile->m_track) {
+            return NULL;
+        }
+    }
     tco_control_t control = tco_control_alloc(ctx,
+                                              &profile->m_arena,
+                                              &profile->m_hot[profile->m_numControls],
+                                              &profile->m_track[profile->m_numControls],
                                               id,
                                               controlType,
                                               x,
                                               y,
                                               width,
                                               height);
-    ctx->m_controls[ctx->m_numControls] = control;
-    ctx->m_numControls++;
+    if(!control) {
+        return NULL;
+    }
+    profile->m_controls[profile->m_numControls] = control;
+    profile->m_numControls++;
     return control;
 }
 
+/* Dots per inch of the display, 0 if unknown. Also fetches the size
+ * of the display. */
+static
+int tco_context_dpi(tco_context_t ctx)
+{
+    if(ctx->m_dpi >= 0) {
+        return ctx->m_dpi;
+    }
+    ctx->m_dpi = 0;
+    ctx->m_displaySize[0] = ctx->m_displaySize[1] = 0;
+    int count = 0;
+    if(screen_get_context_property_iv(ctx->m_screenContext, SCREEN_PROPERTY_DISPLAY_COUNT, &count) || count < 1) {
+        DEBUGLOG("screen: %s (%d)", strerror(errno), errno);
+        return 0;
+    }
+    screen_display_t * displays = (screen_display_t *)calloc(count, sizeof(screen_display_t));
+    if(!displays) {
+        return 0;
+    }
+    int dpi = 0;
+    if(screen_get_context_property_pv(ctx->m_screenContext, SCREEN_PROPERTY_DISPLAYS, (void **)displays) ||
+       screen_get_display_property_iv(displays[0], SCREEN_PROPERTY_DPI, &dpi)) {
+        DEBUGLOG("screen: %s (%d)", strerror(errno), errno);
+        dpi = 0;
+    } else if(screen_get_display_property_iv(displays[0], SCREEN_PROPERTY_SIZE, ctx->m_displaySize)) {
+        DEBUGLOG("screen: %s (%d)", strerror(errno), errno);
+        ctx->m_displaySize[0] = ctx->m_displaySize[1] = 0;
+    }
+    free(displays);
+    ctx->m_dpi = max(dpi, 0);
+    return ctx->m_dpi;
+}
+
+/* Reads the slop in millimeters */
+static
+void tco_control_load_slop(tco_context_t ctx,
+                           tco_control_t c,
+                           cJSON * control)
+{
+    c->m_tapSlopMm = tco_json_get_double_default(control, "tapSlop", 0);
+    if(c->m_tapSlopMm > 0) {
+        int dpi = tco_context_dpi(ctx);
+        if(dpi > 0) {
+            c->m_tapSlop = max(1, (int)(c->m_tapSlopMm * dpi / 25.4f + 0.5f));
+        } else {
+            DEBUGLOG("Display DPI unknown, tap slop stays %d pixels", c->m_tapSlop);
+        }
+    }
+}
+
+/* Reads the thresholds in millimeters and milliseconds and the filter */
+static
+void tco_control_load_tracking(tco_context_t ctx,
+                               tco_control_t c,
+                               cJSON * control)
+{
+    tco_control_load_slop(ctx, c, control);
+    c->m_tapTimeMs = max(0, tco_json_get_int_default(control, "tapTime", 0));
+    c->m_holdTimeMs = max(0, tco_json_get_int_default(control, "holdTime", 0));
+    if(c->m_tapTimeMs > 0) {
+        c->m_tapTime = c->m_tapTimeMs * 1000000LL;
+    }
+    if(c->m_holdTimeMs > 0) {
+        c->m_holdTime = c->m_holdTimeMs * 1000000LL;
+    }
+
+    double cutoff = tco_json_get_double_default(control, "filterCutoff", 0);
+    if(cutoff > 0) {
+        c->m_filterCutoff = (int)(cutoff * 65536);
+        c->m_filterBeta = (int)(tco_json_get_double_default(control, "filterBeta", 0) * 65536);
+        c->m_filterDerivativeCutoff = (int)(tco_json_get_double_default(control, "filterDerivativeCutoff", 1.0) * 65536);
+    }
+}
+
+static
+void tco_control_save_tracking(tco_control_t control,
+                               cJSON * json_control)
+{
+    if(control->m_tapSlopMm > 0) {
+        tco_json_set_double(json_control, "tapSlop", control->m_tapSlopMm);
+    }
+    if(control->m_tapTimeMs > 0) {
+        tco_json_set_int(json_control, "tapTime", control->m_tapTimeMs);
+    }
+    if(control->m_holdTimeMs > 0) {
+        tco_json_set_int(json_control, "holdTime", control->m_holdTimeMs);
+    }
+    if(control->m_filterCutoff > 0) {
+        tco_json_set_double(json_control, "filterCutoff", control->m_filterCutoff / 65536.0);
+        tco_json_set_double(json_control, "filterBeta", control->m_filterBeta / 65536.0);
+        tco_json_set_double(json_control, "filterDerivativeCutoff", control->m_filterDerivativeCutoff / 65536.0);
+    }
+}
+
+static
+int tco_mm_to_pixels(float mm,
+                     int dpi)
+{
+    return (int)(mm * dpi / 25.4f + 0.5f);
+}
+
+static
+void tco_profile_load_rejection(tco_context_t ctx,
+                                tco_profile_t profile,
+                                cJSON * root)
+{
+    struct tco_rejection * rules = &profile->m_rejection;
+    memset(rules, 0, sizeof(*rules));
+    cJSON * rejection = cJSON_GetObjectItem(root, "rejection");
+    if(rejection == NULL || rejection->type != cJSON_Object) {
+        return;
+    }
+    rules->m_maxSizeMm = tco_json_get_double_default(rejection, "maxContactSize", 0);
+    rules->m_maxAspect = tco_json_get_int_default(rejection, "maxAspect", 0);
+    rules->m_orientationRange[0] = tco_json_get_int_default(rejection, "orientationMin", 0);
+    rules->m_orientationRange[1] = tco_json_get_int_default(rejection, "orientationMax", 360);
+    cJSON * edges = cJSON_GetObjectItem(rejection, "edges");
+    if(edges != NULL && edges->type == cJSON_Array && cJSON_GetArraySize(edges) == 4) {
+        int i;
+        for(i = 0; i < 4; ++i) {
+            cJSON * edge = cJSON_GetArrayItem(edges, i);
+            rules->m_edgesMm[i] = edge->type == cJSON_Number ? edge->valuedouble : 0;
+        }
+    }
+
+    int dpi = tco_context_dpi(ctx);
+    if(dpi <= 0 && (rules->m_maxSizeMm > 0 || edges != NULL)) {
+        DEBUGLOG("Display DPI unknown, size and edge rejection disabled");
+    }
+    if(dpi > 0) {
+        int i;
+        rules->m_maxSize = rules->m_maxSizeMm > 0 ? tco_mm_to_pixels(rules->m_maxSizeMm, dpi) : 0;
+        for(i = 0; i < 4; ++i) {
+            rules->m_edges[i] = rules->m_edgesMm[i] > 0 ? tco_mm_to_pixels(rules->m_edgesMm[i], dpi) : 0;
+        }
+    }
+    rules->m_enabled = rules->m_maxSize > 0 ||
+                       rules->m_maxAspect > 0 ||
+                       rules->m_edges[0] > 0 || rules->m_edges[1] > 0 ||
+                       rules->m_edges[2] > 0 || rules->m_edges[3] > 0;
+}
+
+static
+void tco_profile_save_rejection(tco_profile_t profile,
+                                cJSON * root)
+{
+    struct tco_rejection * rules = &profile->m_rejection;
+    if(rules->m_maxSizeMm <= 0 && rules->m_maxAspect <= 0 &&
+       rules->m_edgesMm[0] <= 0 && rules->m_edgesMm[1] <= 0 &&
+       rules->m_edgesMm[2] <= 0 && rules->m_edgesMm[3] <= 0) {
+        return;
+    }
+    cJSON * rejection = cJSON_CreateObject();
+    if(!rejection) {
+        return;
+    }
+    cJSON_AddItemToObject(root, "rejection", rejection);
+    if(rules->m_maxSizeMm > 0) {
+        tco_json_set_double(rejection, "maxContactSize", rules->m_maxSizeMm);
+    }
+    if(rules->m_maxAspect > 0) {
+        tco_json_set_int(rejection, "maxAspect", rules->m_maxAspect);
+        tco_json_set_int(rejection, "orientationMin", rules->m_orientationRange[0]);
+        tco_json_set_int(rejection, "orientationMax", rules->m_orientationRange[1]);
+    }
+    cJSON * edges = cJSON_CreateArray();
+    if(edges) {
+        int i;
+        for(i = 0; i < 4; ++i) {
+            cJSON * edge = cJSON_CreateNumber(rules->m_edgesMm[i]);
+            if(edge) {
+                cJSON_AddItemToArray(edges, edge);
+            }
+        }
+        cJSON_AddItemToObject(rejection, "edges", edges);
+    }
+}
+
+static const char * const tco_accel_names[] = {"none", "linear", "power", "table"};
+
+static
+void tco_control_load_accel(tco_control_t c,
+                            cJSON * control)
+{
+    const char * accel = tco_json_get_str_default(control, "accel", "none");
+    c->m_properties.touch.m_accel = TCO_ACCEL_NONE;
+    int i;
+    for (i = 0; i < (int)(sizeof(tco_accel_names) / sizeof(tco_accel_names[0])); ++i) {
+        if (strcmp(accel, tco_accel_names[i]) == 0) {
+            c->m_properties.touch.m_accel = (tco_accel_type)i;
+        }
+    }
+    c->m_properties.touch.m_gain = tco_json_get_int_default(control, "gain", 100);
+    c->m_properties.touch.m_exponent = tco_json_get_int_default(control, "exponent", 150);
+    c->m_properties.touch.m_velocity = tco_json_get_int_default(control, "velocity", 0);
+    c->m_properties.touch.m_reference = tco_json_get_int_default(control, "reference",
+                                                                 c->m_properties.touch.m_velocity ? 1000 : 10);
+    if (c->m_properties.touch.m_reference <= 0) {
+        c->m_properties.touch.m_reference = 1;
+    }
+
+    /* Table of [speed, gain] pairs with increasing speed */
+    c->m_properties.touch.m_tableSize = 0;
+    cJSON * table = cJSON_GetObjectItem(control, "table");
+    if (table != NULL && table->type == cJSON_Array) {
+        int n = min(cJSON_GetArraySize(table), TCO_ACCEL_TABLE_SIZE);
+        for (i = 0; i < n; ++i) {
+            cJSON * point = cJSON_GetArrayItem(table, i);
+            if (point == NULL || point->type != cJSON_Array || cJSON_GetArraySize(point) != 2 ||
+                cJSON_GetArrayItem(point, 0)->type != cJSON_Number ||
+                cJSON_GetArrayItem(point, 1)->type != cJSON_Number) {
+                DEBUGLOG("Invalid acceleration table point %d", i);
+                break;
+            }
+            int speed = cJSON_GetArrayItem(point, 0)->valueint;
+            int size = c->m_properties.touch.m_tableSize;
+            if (size > 0 && speed <= c->m_properties.touch.m_table[size - 1][0]) {
+                DEBUGLOG("Acceleration table speeds must increase");
+                break;
+            }
+            c->m_properties.touch.m_table[size][0] = speed;
+            c->m_properties.touch.m_table[size][1] = cJSON_GetArrayItem(point, 1)->valueint;
+            c->m_properties.touch.m_tableSize++;
+        }
+    }
+    if (c->m_properties.touch.m_accel == TCO_ACCEL_TABLE &&
+        c->m_properties.touch.m_tableSize == 0) {
+        DEBUGLOG("Acceleration table is empty, using linear gain");
+        c->m_properties.touch.m_accel = TCO_ACCEL_LINEAR;
+    }
+}
+
+static
+void tco_control_save_accel(tco_control_t control,
+                            cJSON * json_control)
+{
+    if (control->m_properties.touch.m_accel == TCO_ACCEL_NONE) {
+        return;
+    }
+    tco_json_set_str(json_control, "accel", tco_accel_names[control->m_properties.touch.m_accel]);
+    tco_json_set_int(json_control, "gain", control->m_properties.touch.m_gain);
+    tco_json_set_int(json_control, "exponent", control->m_properties.touch.m_exponent);
+    tco_json_set_int(json_control, "reference", control->m_properties.touch.m_reference);
+    tco_json_set_int(json_control, "velocity", control->m_properties.touch.m_velocity);
+    if (control->m_properties.touch.m_tableSize > 0) {
+        cJSON * table = cJSON_CreateArray();
+        if (table) {
+            int i;
+            for (i = 0; i < control->m_properties.touch.m_tableSize; ++i) {
+                cJSON * point = cJSON_CreateIntArray(control->m_properties.touch.m_table[i], 2);
+                if (point) {
+                    cJSON_AddItemToArray(table, point);
+                }
+            }
+            cJSON_AddItemToObject(json_control, "table", table);
+        }
+    }
+}
+
 static
 int tco_context_load_controls(tco_context_t ctx,
+                              tco_profile_t profile,
                               const char * default_fileName,
                               const char * user_fileName)
 {
@@ -1766,10 +4639,9 @@ int tco_context_load_controls(tco_context_t ctx,
     int retCode = TCO_FAILURE;
     int version;
     cJSON *root = 0;
-    free(ctx->m_user_control_path);
-    ctx->m_user_control_path = NULL;
+    profile->m_user_control_path = NULL;
     if(user_fileName) {
-        ctx->m_user_control_path = strdup(user_fileName);
+        profile->m_user_control_path = tco_arena_strdup(&profile->m_arena, user_fileName);
     }
 
     /* Read the user JSON file if it is there */
@@ -1797,6 +4669,8 @@ int tco_context_load_controls(tco_context_t ctx,
             break;
         }
 
+        tco_profile_load_rejection(ctx, profile, root);
+
         /* Get control descriptions */
         cJSON *controls = cJSON_GetObjectItem(root, "controls");
         if (controls != NULL && controls->type == cJSON_Array)
@@ -1816,23 +4690,52 @@ int tco_context_load_controls(tco_context_t ctx,
                     int height = tco_json_get_int(control, "height");
 
                     tco_control_t c = tco_context_create_control(ctx,
+                                                                 profile,
                                                                  id,
                                                                  control_type,
                                                                  x,
                                                                  y,
                                                                  width,
                                                                  height);
+                    if (!c) {
+                        /* Over the control limit or out of memory */
+                        DEBUGLOG("Control %d skipped", id);
+                        continue;
+                    }
 
                     /* Control specific properties */
-                    switch(c->m_type){
+                    switch(c->m_hot->m_type){
                     case KEY:
                         c->m_properties.key.m_symbol = tco_json_get_int(control, "symbol");
                         c->m_properties.key.m_modifier = tco_json_get_int(control, "modifier");
                         c->m_properties.key.m_scancode = tco_json_get_int(control, "scancode");
                         c->m_properties.key.m_unicode = tco_json_get_int(control, "unicode");
+                        c->m_properties.key.m_repeatDelay = max(0, tco_json_get_int_default(control, "repeatDelay", 0));
+                        c->m_properties.key.m_repeatRate = max(0, tco_json_get_int_default(control, "repeatRate", 0));
+                        c->m_properties.key.m_turbo = tco_json_get_int_default(control, "turbo", 0);
+                        c->m_properties.key.m_glide = tco_json_get_int_default(control, "glide", 0);
                         break;
                     case TOUCHAREA:
                         c->m_properties.touch.m_tapSensitive = tco_json_get_int(control, "tapSensitive");
+                        tco_control_load_accel(c, control);
+                        break;
+                    case ANALOG:
+                        c->m_properties.analog.m_deadZone = tco_json_get_int_default(control, "deadZone", 10);
+                        c->m_properties.analog.m_outerZone = tco_json_get_int_default(control, "outerZone", 100);
+                        c->m_properties.analog.m_curve = tco_json_get_int_default(control, "curve", 100);
+                        c->m_properties.analog.m_floating = tco_json_get_int_default(control, "floating", 0);
+                        c->m_properties.analog.m_rate = max(0, tco_json_get_int_default(control, "rate", 60));
+                        if (c->m_properties.analog.m_deadZone < 0 ||
+                            c->m_properties.analog.m_outerZone <= c->m_properties.analog.m_deadZone) {
+                            DEBUGLOG("Invalid analog zones (%d, %d)",
+                                     c->m_properties.analog.m_deadZone,
+                                     c->m_properties.analog.m_outerZone);
+                            c->m_properties.analog.m_deadZone = 10;
+                            c->m_properties.analog.m_outerZone = 100;
+                        }
+                        if (c->m_properties.analog.m_curve <= 0) {
+                            c->m_properties.analog.m_curve = 100;
+                        }
                         break;
                     case MOUSEBUTTON:
                         c->m_properties.mouse.m_mask = tco_json_get_int(control, "mask");
@@ -1841,6 +4744,33 @@ int tco_context_load_controls(tco_context_t ctx,
                     default:
                         break;
                     }
+                    c->m_priority = tco_json_get_int_default(control, "priority", 0);
+                    c->m_passThrough = tco_json_get_int_default(control, "passThrough", 0) != 0;
+                    c->m_layer = tco_json_get_int_default(control, "layer", 0);
+                    if (c->m_layer < 0 || c->m_layer >= TCO_MAX_LAYERS) {
+                        DEBUGLOG("Invalid layer %d", c->m_layer);
+                        c->m_layer = 0;
+                    }
+                    if (c->m_hot->m_type == GESTURE) {
+                        int maxTouches = tco_json_get_int_default(control, "maxTouches", 2);
+                        c->m_hot->m_state.gesture.m_maxTouches = max(1, min(maxTouches, TCO_GESTURE_MAX_TOUCHES));
+                        c->m_properties.gesture.m_swipeDistanceMm = tco_json_get_double_default(control, "swipeDistance", 0);
+                        c->m_properties.gesture.m_swipeTime = tco_json_get_int_default(control, "swipeTime", 300);
+                        float swipeDistanceMm = c->m_properties.gesture.m_swipeDistanceMm > 0 ?
+                                                c->m_properties.gesture.m_swipeDistanceMm :
+                                                TCO_GESTURE_SWIPE_DISTANCE;
+                        int dpi = tco_context_dpi(ctx);
+                        c->m_properties.gesture.m_swipeDistance = dpi > 0 ?
+                                                                  max(1, tco_mm_to_pixels(swipeDistanceMm, dpi)) :
+                                                                  SWIPE_THRESHOLD;
+                        /* Only the slop applies to the contacts of a gesture */
+                        tco_control_load_slop(ctx, c, control);
+                    }
+                    if (c->m_hot->m_type == TOUCHAREA || c->m_hot->m_type == TOUCHSCREEN) {
+                        c->m_predictLead = max(0, tco_json_get_int_default(control, "predict", 0));
+                        tco_control_load_tracking(ctx, c, control);
+                    }
+
                     /* Label for the control */
                     cJSON *label = cJSON_GetObjectItem(control, "label");
                     if (label != NULL && label->type == cJSON_Object)
@@ -1851,17 +4781,24 @@ int tco_context_load_controls(tco_context_t ctx,
                         int label_height = tco_json_get_int(label, "height");
                         int label_alpha = tco_json_get_int(label, "alpha");
                         const char * label_image = tco_json_get_str(label, "image");
+                        const char * label_pressed_image = tco_json_get_str_default(label, "pressedImage", NULL);
+                        int label_pressed_alpha = tco_json_get_int_default(label, "pressedAlpha", -1);
 
                         tco_label_t p = tco_label_alloc(ctx,
+                                                        &profile->m_arena,
                                                         c,
                                                         label_x,
                                                         label_y,
                                                         label_width,
                                                         label_height,
                                                         label_alpha,
-                                                        label_image);
+                                                        label_image,
+                                                        label_pressed_image,
+                                                        label_pressed_alpha);
                         c->m_label = p;
-                        p->m_control = c;
+                        if(p) {
+                            p->m_control = c;
+                        }
                     }
                 }
                 else
@@ -1882,6 +4819,10 @@ int tco_context_load_controls(tco_context_t ctx,
         break;
     }
 
+    tco_profile_rank(profile);
+    tco_profile_update_hidden(profile, ctx->m_hiddenLayers);
+    tco_profile_grid_rebuild(profile);
+
     if (root != 0)
     {
         /* Delete JSON structure */
@@ -1905,7 +4846,7 @@ int tco_context_save_controls(tco_context_t ctx,
     }
     const char * filePath = user_fileName;
     if(filePath == NULL) {
-        filePath = ctx->m_user_control_path;
+        filePath = ctx->m_profile->m_user_control_path;
     }
     if(!filePath) {
         return TCO_SUCCESS; /* No file to be saved, fine */
@@ -1918,8 +4859,10 @@ int tco_context_save_controls(tco_context_t ctx,
         cJSON_AddItemToObject(root, "controls", controls_array);
 
         int i = 0;
-        for(i = 0; i < ctx->m_numControls; ++i) {
-            tco_control_t control = ctx->m_controls[i];
+        tco_profile_t profile = ctx->m_profile;
+        tco_profile_save_rejection(profile, root);
+        for(i = 0; i < profile->m_numControls; ++i) {
+            tco_control_t control = profile->m_controls[i];
             if(!control) {
                 continue;
             }
@@ -1927,13 +4870,21 @@ int tco_context_save_controls(tco_context_t ctx,
             cJSON * json_control = cJSON_CreateObject();
             cJSON_AddItemToArray(controls_array, json_control);
 
-            switch(control->m_type) {
+            switch(control->m_hot->m_type) {
             case KEY:
                 tco_json_set_str(json_control, "type", "key");
                 tco_json_set_int(json_control, "symbol", control->m_properties.key.m_symbol);
                 tco_json_set_int(json_control, "modifier", control->m_properties.key.m_modifier);
                 tco_json_set_int(json_control, "scancode", control->m_properties.key.m_scancode);
                 tco_json_set_int(json_control, "unicode", control->m_properties.key.m_unicode);
+                if(control->m_properties.key.m_repeatRate > 0) {
+                    tco_json_set_int(json_control, "repeatDelay", control->m_properties.key.m_repeatDelay);
+                    tco_json_set_int(json_control, "repeatRate", control->m_properties.key.m_repeatRate);
+                    tco_json_set_int(json_control, "turbo", control->m_properties.key.m_turbo);
+                }
+                if(control->m_properties.key.m_glide) {
+                    tco_json_set_int(json_control, "glide", control->m_properties.key.m_glide);
+                }
                 break;
             case DPAD:
                 tco_json_set_str(json_control, "type", "dpad");
@@ -1946,20 +4897,51 @@ int tco_context_save_controls(tco_context_t ctx,
             case TOUCHAREA:
                 tco_json_set_str(json_control, "type", "toucharea");
                 tco_json_set_int(json_control, "tapSensitive", control->m_properties.touch.m_tapSensitive);
+                tco_control_save_accel(control, json_control);
                 break;
             case TOUCHSCREEN:
                 tco_json_set_str(json_control, "type", "touchscreen");
                 break;
+            case GESTURE:
+                tco_json_set_str(json_control, "type", "gesture");
+                tco_json_set_int(json_control, "maxTouches", control->m_hot->m_state.gesture.m_maxTouches);
+                if(control->m_properties.gesture.m_swipeDistanceMm > 0) {
+                    tco_json_set_double(json_control, "swipeDistance", control->m_properties.gesture.m_swipeDistanceMm);
+                }
+                tco_json_set_int(json_control, "swipeTime", control->m_properties.gesture.m_swipeTime);
+                break;
+            case ANALOG:
+                tco_json_set_str(json_control, "type", "analog");
+                tco_json_set_int(json_control, "deadZone", control->m_properties.analog.m_deadZone);
+                tco_json_set_int(json_control, "outerZone", control->m_properties.analog.m_outerZone);
+                tco_json_set_int(json_control, "curve", control->m_properties.analog.m_curve);
+                tco_json_set_int(json_control, "floating", control->m_properties.analog.m_floating);
+                tco_json_set_int(json_control, "rate", control->m_properties.analog.m_rate);
+                break;
             default:
                 tco_json_set_str(json_control, "type", "unknown");
                 break;
             }
 
+            if(control->m_predictLead > 0) {
+                tco_json_set_int(json_control, "predict", control->m_predictLead);
+            }
+            tco_control_save_tracking(control, json_control);
+            if(control->m_priority != 0) {
+                tco_json_set_int(json_control, "priority", control->m_priority);
+            }
+            if(control->m_passThrough) {
+                tco_json_set_int(json_control, "passThrough", 1);
+            }
+            if(control->m_layer != 0) {
+                tco_json_set_int(json_control, "layer", control->m_layer);
+            }
+
             tco_json_set_int(json_control, "id", control->m_id);
-            tco_json_set_int(json_control, "x", control->m_x);
-            tco_json_set_int(json_control, "y", control->m_y);
-            tco_json_set_int(json_control, "width", control->m_width);
-            tco_json_set_int(json_control, "height", control->m_height);
+            tco_json_set_int(json_control, "x", control->m_hot->m_x);
+            tco_json_set_int(json_control, "y", control->m_hot->m_y);
+            tco_json_set_int(json_control, "width", control->m_hot->m_width);
+            tco_json_set_int(json_control, "height", control->m_hot->m_height);
 
             if(control->m_label != NULL) {
                 cJSON * label = cJSON_CreateObject();
@@ -1973,6 +4955,12 @@ int tco_context_save_controls(tco_context_t ctx,
                 if(control->m_label->m_image_file) {
                     tco_json_set_str(label, "image", control->m_label->m_image_file);
                 }
+                if(control->m_label->m_pressed_image_file) {
+                    tco_json_set_str(label, "pressedImage", control->m_label->m_pressed_image_file);
+                }
+                if(control->m_label->m_pressedAlpha >= 0) {
+                    tco_json_set_int(label, "pressedAlpha", control->m_label->m_pressedAlpha);
+                }
             }
         }
 
@@ -2003,6 +4991,126 @@ int tco_context_save_controls(tco_context_t ctx,
     return TCO_SUCCESS;
 }
 
+/* Converts an event timestamp to tco_clock_now(), which all deadlines
+ * use. Event timestamps need not come from that clock, the smallest
+ * delay seen between the two is taken as their offset plus the delivery
+ * latency. */
+static
+long long tco_context_event_time(tco_context_t ctx,
+                                 long long timestamp,
+                                 long long now)
+{
+    long long delay = now - timestamp;
+    if(delay < ctx->m_eventDelay) {
+        ctx->m_eventDelay = delay;
+    }
+    return timestamp + ctx->m_eventDelay;
+}
+
+/* Remembers the newest event of a contact and, in latest wins mode,
+ * tells whether a move is out of order or too old to be worth handling.
+ * Presses and releases are never dropped, the next move or the release
+ * carries the position a dropped move would have reported. The age is
+ * how long the event waited beyond the smallest delay seen. */
+static
+bool tco_context_drop_touch(tco_context_t ctx,
+                            int type,
+                            int touch_id,
+                            int sequenceId,
+                            long long timestamp,
+                            long long age)
+{
+    struct tco_touch_sequence * last = &ctx->m_touchSequence[touch_id];
+    if(type != SCREEN_EVENT_MTOUCH_MOVE) {
+        last->m_sequenceId = sequenceId;
+        last->m_timestamp = timestamp;
+        return false;
+    }
+    if(ctx->m_latestWins) {
+        if(sequenceId - last->m_sequenceId <= 0 || timestamp < last->m_timestamp) {
+            ctx->m_eventStats.superseded_moves++;
+            return true;
+        }
+        if(ctx->m_maxEventAge > 0 && age > ctx->m_maxEventAge) {
+            ctx->m_eventStats.stale_moves++;
+            return true;
+        }
+    }
+    last->m_sequenceId = sequenceId;
+    last->m_timestamp = timestamp;
+    return false;
+}
+
+/* Tells whether a new contact looks like a palm, the contact geometry
+ * is only fetched for the rules that are enabled */
+static
+bool tco_context_reject_touch(tco_context_t ctx,
+                              tco_profile_t profile,
+                              screen_event_t event)
+{
+    struct tco_rejection * rules = &profile->m_rejection;
+    int rc;
+    if(rules->m_maxSize > 0 || rules->m_maxAspect > 0) {
+        int size[2];
+        rc = screen_get_event_property_iv(event, SCREEN_PROPERTY_SIZE, size);
+        if(rc) {
+            DEBUGLOG("screen: %s (%d)", strerror(errno), errno);
+            return false;
+        }
+        if(rules->m_maxSize > 0 &&
+           (size[0] > rules->m_maxSize || size[1] > rules->m_maxSize)) {
+            return true;
+        }
+        int shortSide = max(min(size[0], size[1]), 1);
+        if(rules->m_maxAspect > 0 &&
+           max(size[0], size[1]) * 100 > rules->m_maxAspect * shortSide) {
+            int orientation;
+            rc = screen_get_event_property_iv(event, SCREEN_PROPERTY_TOUCH_ORIENTATION, &orientation);
+            if(rc) {
+                DEBUGLOG("screen: %s (%d)", strerror(errno), errno);
+                return false;
+            }
+            if(orientation >= rules->m_orientationRange[0] &&
+               orientation <= rules->m_orientationRange[1]) {
+                return true;
+            }
+        }
+    }
+    if(rules->m_edges[0] > 0 || rules->m_edges[1] > 0 ||
+       rules->m_edges[2] > 0 || rules->m_edges[3] > 0) {
+        int screenPos[2];
+        rc = screen_get_event_property_iv(event, SCREEN_PROPERTY_POSITION, screenPos);
+        if(rc) {
+            DEBUGLOG("screen: %s (%d)", strerror(errno), errno);
+            return false;
+        }
+        if(screenPos[0] < rules->m_edges[0] ||
+           screenPos[1] < rules->m_edges[1] ||
+           (ctx->m_displaySize[0] > 0 && screenPos[0] >= ctx->m_displaySize[0] - rules->m_edges[2]) ||
+           (ctx->m_displaySize[1] > 0 && screenPos[1] >= ctx->m_displaySize[1] - rules->m_edges[3])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Pressed states of the labels change together */
+static
+void tco_context_flush_labels(tco_context_t ctx)
+{
+    if(!ctx->m_labelsChanged) {
+        return;
+    }
+    ctx->m_labelsChanged = false;
+    if(ctx->m_labelParent == NULL) {
+        return;
+    }
+    int rc = screen_flush_context(ctx->m_screenContext, 0);
+    if(rc) {
+        DEBUGLOG("screen: %s (%d)", strerror(errno), errno);
+    }
+}
+
 static
 bool tco_context_touch_event(tco_context_t ctx,
                              screen_event_t event)
@@ -2014,8 +5122,7 @@ bool tco_context_touch_event(tco_context_t ctx,
     int type;
     int touch_id;
     int pos[2];
-    int screenPos[2];
-    int orientation;
+    long long eventTimestamp;
     long long timestamp;
     int sequenceId;
     bool handled = false;
@@ -2032,36 +5139,65 @@ bool tco_context_touch_event(tco_context_t ctx,
         return false;
     }
 
-    rc = screen_get_event_property_iv(event, SCREEN_PROPERTY_SOURCE_POSITION, pos);
-    if(rc) {
-        DEBUGLOG("screen: %s (%d)", strerror(errno), errno);
+    /* A contact that cannot be tracked is never handled, rather than
+     * handled without palm rejection and ordering */
+    if(touch_id < 0 || touch_id >= TCO_MAX_TOUCH_IDS) {
+        DEBUGLOG("Touch id %d out of range", touch_id);
         return false;
     }
 
-    rc = screen_get_event_property_iv(event, SCREEN_PROPERTY_POSITION, screenPos);
-    if(rc) {
-        DEBUGLOG("screen: %s (%d)", strerror(errno), errno);
+    /* Rejected contacts are dropped before anything else is looked at */
+    uint64_t touchBit = 1ULL << touch_id;
+    if(ctx->m_rejectedTouches & touchBit) {
+        if(type == SCREEN_EVENT_MTOUCH_RELEASE) {
+            ctx->m_rejectedTouches &= ~touchBit;
+        }
         return false;
     }
 
-    rc = screen_get_event_property_iv(event, SCREEN_PROPERTY_TOUCH_ORIENTATION, &orientation);
+    rc = screen_get_event_property_llv(event, SCREEN_PROPERTY_TIMESTAMP, &eventTimestamp);
     if(rc) {
         DEBUGLOG("screen: %s (%d)", strerror(errno), errno);
         return false;
     }
 
-    rc = screen_get_event_property_llv(event, SCREEN_PROPERTY_TIMESTAMP, &timestamp);
+    /* The event is handled at its own time on the clock of the deadlines,
+     * what it waited beyond the smallest delay seen is its age */
+    long long now = tco_clock_now();
+    timestamp = tco_context_event_time(ctx, eventTimestamp, now);
+
+    /* Deadlines that passed before this event fire first */
+    tco_context_run_timers(ctx, timestamp);
+
+    rc = screen_get_event_property_iv(event, SCREEN_PROPERTY_SEQUENCE_ID, &sequenceId);
     if(rc) {
         DEBUGLOG("screen: %s (%d)", strerror(errno), errno);
         return false;
     }
 
-    rc = screen_get_event_property_iv(event, SCREEN_PROPERTY_SEQUENCE_ID, &sequenceId);
+    if(tco_context_drop_touch(ctx, type, touch_id, sequenceId, eventTimestamp, now - timestamp)) {
+        return false;
+    }
+
+    if(ctx->m_idleStep > 0) {
+        if(tco_context_idle_wake(ctx, timestamp) && ctx->m_labelParent != NULL) {
+            rc = screen_flush_context(ctx->m_screenContext, 0);
+            if(rc) {
+                DEBUGLOG("screen: %s (%d)", strerror(errno), errno);
+            }
+        }
+    } else {
+        ctx->m_lastActivity = timestamp;
+    }
+
+    rc = screen_get_event_property_iv(event, SCREEN_PROPERTY_SOURCE_POSITION, pos);
     if(rc) {
         DEBUGLOG("screen: %s (%d)", strerror(errno), errno);
         return false;
     }
 
+    tco_profile_t profile = ctx->m_profile;
+
     /* Find the first owner of the touch_id */
     tco_control_t touchPointOwner = 0;
     touch_owner_t p = NULL;
@@ -2070,43 +5206,95 @@ bool tco_context_touch_event(tco_context_t ctx,
             touchPointOwner = p->control;
             break;
         }
-    }
-    if (touchPointOwner) {
-        /* touchPointOwner points to control and p points to list entry */
-        handled = tco_control_handle_touch(touchPointOwner,
-                                           ctx,
-                                           type,
-                                           touch_id,
-                                           pos[0],
-                                           pos[1],
-                                           timestamp);
-        if (!handled) {
+    }
+    /* A contact is classified once, when it lands. The decision holds
+     * until it lifts, even if it later grows or slides into an edge. */
+    if (type == SCREEN_EVENT_MTOUCH_TOUCH &&
+        profile->m_rejection.m_enabled &&
+        tco_context_reject_touch(ctx, profile, event)) {
+        ctx->m_rejectedTouches |= touchBit;
+        return false;
+    }
+
+    /* Every owner gets the event, a contact is shared by a pass-through
+     * control and the controls it lets through */
+    uint32_t checked = 0;
+    while (p) {
+        touch_owner_t next = SLIST_NEXT(p, link);
+        if (p->touch_id != touch_id) {
+            p = next;
+            continue;
+        }
+        touchPointOwner = p->control;
+        checked |= 1u << touchPointOwner->m_hot->m_rank;
+        bool ownerHandled = tco_control_handle_touch(touchPointOwner,
+                                                     ctx,
+                                                     type,
+                                                     touch_id,
+                                                     pos[0],
+                                                     pos[1],
+                                                     timestamp);
+        if (!ownerHandled &&
+            type == SCREEN_EVENT_MTOUCH_MOVE &&
+            touchPointOwner->m_hot->m_type == KEY &&
+            touchPointOwner->m_properties.key.m_glide) {
+            /* Glide: the key up was just sent, press whatever is under
+             * the contact now and keep the owner record */
+            int i = tco_profile_free_control_at(profile, pos[0], pos[1]);
+            if (i != -1 &&
+                tco_control_handle_touch(profile->m_controls[i],
+                                         ctx,
+                                         type,
+                                         touch_id,
+                                         pos[0],
+                                         pos[1],
+                                         timestamp)) {
+                p->control = profile->m_controls[i];
+                ownerHandled = true;
+            }
+        }
+        if (ownerHandled) {
+            handled = true;
+        } else {
             SLIST_REMOVE(&ctx->m_touch_owners, p, touch_owner, link);
-            free(p);
+            tco_context_touch_owner_put(ctx, p);
         }
+        p = next;
     }
 
     if (!handled) {
-        int i;
-        for (i = 0; i < ctx->m_numControls; ++i) {
-            if (ctx->m_controls[i] == touchPointOwner) {
-                continue; /* already checked */
+        /* Only the controls overlapping the grid cell of the contact are
+         * tested, top-most first. The first one to take the touch owns
+         * it, unless it lets the touch through to the controls below. */
+        uint32_t mask = tco_profile_grid_mask(profile, pos[0], pos[1]) & ~(checked | profile->m_hidden);
+        while (mask) {
+            int rank = __builtin_ctz(mask);
+            int i = profile->m_order[rank];
+            mask &= mask - 1;
+            tco_control_hot_t hot = &profile->m_hot[i];
+            /* Controls that are busy or missed are rejected from the hot array alone */
+            if (!tco_control_hot_accepts(hot) ||
+                !tco_control_hot_point_inside(hot, pos[0], pos[1])) {
+                continue;
             }
 
-            handled |= tco_control_handle_touch(ctx->m_controls[i],
-                                                ctx,
-                                                type,
-                                                touch_id,
-                                                pos[0],
-                                                pos[1],
-                                                timestamp);
-            if (handled) {
-                p = (touch_owner_t)calloc(1, sizeof(struct touch_owner));
-                p->control = ctx->m_controls[i];
-                p->touch_id = touch_id;
-                SLIST_INSERT_HEAD(&ctx->m_touch_owners, p, link);
-                /* Only allow the first control to handle the touch. */
-                break;
+            if (tco_control_handle_touch(hot->m_control,
+                                         ctx,
+                                         type,
+                                         touch_id,
+                                         pos[0],
+                                         pos[1],
+                                         timestamp)) {
+                handled = true;
+                p = tco_context_touch_owner_get(ctx);
+                if(p) {
+                    p->control = profile->m_controls[i];
+                    p->touch_id = touch_id;
+                    SLIST_INSERT_HEAD(&ctx->m_touch_owners, p, link);
+                }
+                if (!(profile->m_passThrough & (1u << rank))) {
+                    break;
+                }
             }
         }
     }
@@ -2114,6 +5302,61 @@ bool tco_context_touch_event(tco_context_t ctx,
     return handled;
 }
 
+static
+int tco_context_navigator_event(tco_context_t ctx,
+                                screen_window_t window,
+                                int event_code)
+{
+    if(ctx->m_configWindow != NULL) {
+        /* Configuration window is shown */
+        switch(event_code) {
+        case NAVIGATOR_EXIT:
+            tco_configuration_window_free(ctx->m_configWindow);
+            ctx->m_configWindow = 0;
+            break;
+        case NAVIGATOR_SWIPE_DOWN:
+            {
+                tco_configuration_window_free(ctx->m_configWindow);
+                ctx->m_configWindow = 0;
+                tco_context_save_controls(ctx, ctx->m_profile->m_user_control_path);
+            }
+            return TCO_SUCCESS;
+        default:
+            break;
+        }
+    } else {
+        /* Configuration window is not shown */
+        switch(event_code) {
+        case NAVIGATOR_EXIT:
+            break;
+        case NAVIGATOR_SWIPE_DOWN:
+            /* Start configuration window */
+            ctx->m_configWindow = tco_configuration_alloc(ctx, window);
+            if (ctx->m_configWindow) {
+                return TCO_SUCCESS;
+            } else {
+                return TCO_FAILURE;
+            }
+        default:
+            break;
+        }
+    }
+    return TCO_UNHANDLED;
+}
+
+/* Touch events go to the configuration window while it is shown */
+static
+int tco_context_screen_touch(tco_context_t ctx,
+                             screen_event_t screen_event)
+{
+    if(ctx->m_configWindow != NULL) {
+        return tco_configuration_window_run(ctx->m_configWindow, screen_event);
+    }
+    bool handled = tco_context_touch_event(ctx, screen_event);
+    tco_context_flush_labels(ctx);
+    return handled ? TCO_SUCCESS : TCO_UNHANDLED;
+}
+
 static
 int tco_context_handle_events(tco_context_t ctx,
                               screen_window_t window,
@@ -2124,7 +5367,6 @@ int tco_context_handle_events(tco_context_t ctx,
     }
 
     int domain;
-    int event_code;
 
     if(ctx->m_configWindow != NULL) {
         /* Configuration window is shown */
@@ -2135,22 +5377,7 @@ int tco_context_handle_events(tco_context_t ctx,
         domain = bps_event_get_domain(event);
         if (domain == navigator_get_domain()) {
             /* Handle Navigator events*/
-            event_code = bps_event_get_code(event);
-            switch(event_code) {
-            case NAVIGATOR_EXIT:
-                tco_configuration_window_free(ctx->m_configWindow);
-                ctx->m_configWindow = 0;
-                break;
-            case NAVIGATOR_SWIPE_DOWN:
-                {
-                    tco_configuration_window_free(ctx->m_configWindow);
-                    ctx->m_configWindow = 0;
-                    tco_context_save_controls(ctx, ctx->m_user_control_path);
-                }
-                return TCO_SUCCESS;
-            default:
-                break;
-            }
+            return tco_context_navigator_event(ctx, window, bps_event_get_code(event));
         } else if (domain == screen_get_domain()) {
             int event_type; /* event type */
             screen_event_t screen_event = screen_event_get_event(event);
@@ -2166,7 +5393,7 @@ int tco_context_handle_events(tco_context_t ctx,
                 case SCREEN_EVENT_MTOUCH_TOUCH:
                 case SCREEN_EVENT_MTOUCH_MOVE:
                 case SCREEN_EVENT_MTOUCH_RELEASE:
-                    return tco_configuration_window_run(ctx->m_configWindow, screen_event);
+                    return tco_context_screen_touch(ctx, screen_event);
                 default:
                     break;
                 }
@@ -2180,21 +5407,7 @@ int tco_context_handle_events(tco_context_t ctx,
         domain = bps_event_get_domain(event);
         if (domain == navigator_get_domain()) {
             /* Handle Navigator events*/
-            event_code = bps_event_get_code(event);
-            switch(event_code) {
-            case NAVIGATOR_EXIT:
-                break;
-            case NAVIGATOR_SWIPE_DOWN:
-                /* Start configuration window */
-                ctx->m_configWindow = tco_configuration_alloc(ctx, window);
-                if (ctx->m_configWindow) {
-                    return TCO_SUCCESS;
-                } else {
-                    return TCO_FAILURE;
-                }
-            default:
-                break;
-            }
+            return tco_context_navigator_event(ctx, window, bps_event_get_code(event));
         } else if (domain == screen_get_domain()) {
             int event_type; /* event type */
             screen_event_t screen_event = screen_event_get_event(event);
@@ -2208,7 +5421,7 @@ int tco_context_handle_events(tco_context_t ctx,
                 case SCREEN_EVENT_MTOUCH_TOUCH:
                 case SCREEN_EVENT_MTOUCH_MOVE:
                 case SCREEN_EVENT_MTOUCH_RELEASE:
-                    return tco_context_touch_event(ctx, screen_event) ? TCO_SUCCESS : TCO_UNHANDLED;
+                    return tco_context_screen_touch(ctx, screen_event);
                 //case SCREEN_EVENT_POINTER:
                 //  return tco_context_pointer_event(ctx, screen_event) ? TCO_SUCCESS : TCO_UNHANDLED;
                 default:
@@ -2228,15 +5441,18 @@ int tco_context_draw(tco_context_t ctx,
         return TCO_FAILURE;
     }
     int i;
-    for (i = 0; i < ctx->m_numControls; ++i)
+    tco_profile_t profile = ctx->m_profile;
+    for (i = 0; i < profile->m_numControls; ++i)
     {
-        if(!tco_control_draw_label(ctx->m_controls[i], window)) {
+        if(!tco_control_draw_label(profile->m_controls[i], window)) {
             return TCO_FAILURE;
         }
     }
+    ctx->m_labelParent = window;
     if(!tco_set_controls_alpha(ctx, -1)) {
         return TCO_FAILURE;
     }
+    tco_context_idle_reset(ctx, tco_clock_now());
     return TCO_SUCCESS;
 }
 
@@ -2248,15 +5464,293 @@ tco_control_t tco_context_control_at(tco_context_t ctx,
     if(!ctx) {
         return NULL;
     }
-    int i;
-    for (i = 0; i < ctx->m_numControls; ++i) {
-        if (tco_control_point_inside(ctx->m_controls[i], x, y)) {
-            return ctx->m_controls[i];
+    tco_profile_t profile = ctx->m_profile;
+    uint32_t mask = tco_profile_grid_mask(profile, x, y) & ~profile->m_hidden;
+    while (mask) {
+        int i = profile->m_order[__builtin_ctz(mask)];
+        mask &= mask - 1;
+        if (tco_control_hot_point_inside(&profile->m_hot[i], x, y)) {
+            return profile->m_controls[i];
         }
     }
     return NULL;
 }
 
+static
+int tco_context_load_profile(tco_context_t ctx,
+                             const char * name,
+                             const char * default_fileName,
+                             const char * user_fileName)
+{
+    if(!ctx || !name) {
+        return TCO_FAILURE;
+    }
+    tco_profile_t profile = tco_context_find_profile(ctx, name);
+    if(profile) {
+        /* Reload in place */
+        if(profile == ctx->m_profile) {
+            if(ctx->m_configWindow != NULL) {
+                errno = EBUSY;
+                return TCO_FAILURE;
+            }
+            tco_context_release_touches(ctx);
+        }
+        tco_profile_clear(profile);
+    } else {
+        profile = tco_context_add_profile(ctx, name);
+        if(!profile) {
+            return TCO_FAILURE;
+        }
+    }
+    int rc = tco_context_load_controls(ctx,
+                                       profile,
+                                       default_fileName,
+                                       user_fileName);
+    if(rc == TCO_SUCCESS &&
+       profile == ctx->m_profile &&
+       ctx->m_labelParent != NULL) {
+        if(!tco_profile_set_visible(profile, ctx->m_labelParent, true)) {
+            return TCO_FAILURE;
+        }
+    }
+    return rc;
+}
+
+static
+int tco_context_set_profile(tco_context_t ctx,
+                            const char * name)
+{
+    if(!ctx || !name) {
+        return TCO_FAILURE;
+    }
+    tco_profile_t profile = tco_context_find_profile(ctx, name);
+    if(!profile) {
+        DEBUGLOG("No such profile: %s", name);
+        errno = ENOENT;
+        return TCO_FAILURE;
+    }
+    if(profile == ctx->m_profile) {
+        return TCO_SUCCESS;
+    }
+    if(ctx->m_configWindow != NULL) {
+        /* The editor works on the active profile */
+        errno = EBUSY;
+        return TCO_FAILURE;
+    }
+
+    /* Contacts held on the old profile must not leave keys stuck down */
+    tco_context_release_touches(ctx);
+
+    tco_profile_t previous = ctx->m_profile;
+    ctx->m_profile = profile;
+    if(ctx->m_labelParent != NULL) {
+        if(!tco_profile_set_visible(previous, ctx->m_labelParent, false) ||
+           !tco_profile_set_visible(profile, ctx->m_labelParent, true)) {
+            return TCO_FAILURE;
+        }
+        int rc = screen_flush_context(ctx->m_screenContext, 0);
+        if(rc) {
+            DEBUGLOG("screen: %s (%d)", strerror(errno), errno);
+            return TCO_FAILURE;
+        }
+    }
+    tco_context_idle_reset(ctx, tco_clock_now());
+    return TCO_SUCCESS;
+}
+
+static
+int tco_context_set_editor_grid(tco_context_t ctx,
+                                int snap,
+                                bool noOverlap)
+{
+    if(!ctx || snap < 0) {
+        errno = EINVAL;
+        return TCO_FAILURE;
+    }
+    ctx->m_editorSnap = snap;
+    ctx->m_editorNoOverlap = noOverlap;
+    return TCO_SUCCESS;
+}
+
+static
+int tco_context_set_layer_visible(tco_context_t ctx,
+                                  int layer,
+                                  bool visible)
+{
+    if(!ctx || layer < 0 || layer >= TCO_MAX_LAYERS) {
+        errno = EINVAL;
+        return TCO_FAILURE;
+    }
+    uint32_t bit = 1u << layer;
+    uint32_t hiddenLayers = visible ? ctx->m_hiddenLayers & ~bit : ctx->m_hiddenLayers | bit;
+    if(hiddenLayers == ctx->m_hiddenLayers) {
+        return TCO_SUCCESS;
+    }
+    if(ctx->m_configWindow != NULL) {
+        /* The editor shows every control */
+        errno = EBUSY;
+        return TCO_FAILURE;
+    }
+    ctx->m_hiddenLayers = hiddenLayers;
+    int i;
+    for(i = 0; i < ctx->m_numProfiles; ++i) {
+        tco_profile_update_hidden(ctx->m_profiles[i], hiddenLayers);
+    }
+
+    if(!visible) {
+        /* Contacts held on the layer must not leave keys stuck down */
+        touch_owner_t p = SLIST_FIRST(&ctx->m_touch_owners);
+        while(p) {
+            touch_owner_t next = SLIST_NEXT(p, link);
+            if(p->control->m_layer == layer) {
+                SLIST_REMOVE(&ctx->m_touch_owners, p, touch_owner, link);
+                tco_control_cancel_touch(p->control, ctx);
+                tco_context_touch_owner_put(ctx, p);
+            }
+            p = next;
+        }
+    }
+
+    if(ctx->m_labelParent == NULL) {
+        return TCO_SUCCESS;
+    }
+    /* All label windows of the layer change with a single flush,
+     * faded labels come back with them */
+    if(!tco_context_idle_wake(ctx, tco_clock_now())) {
+        return TCO_FAILURE;
+    }
+    tco_profile_t profile = ctx->m_profile;
+    for(i = 0; i < profile->m_numControls; ++i) {
+        tco_control_t control = profile->m_controls[i];
+        if(control->m_layer != layer || control->m_label == NULL) {
+            continue;
+        }
+        tco_window_t w = &control->m_label->m_label_window->m_baseWindow;
+        if(!tco_control_draw_label(control, ctx->m_labelParent) ||
+           (visible && !tco_window_set_alpha(w, w->m_alpha))) {
+            return TCO_FAILURE;
+        }
+    }
+    int rc = screen_flush_context(ctx->m_screenContext, 0);
+    if(rc) {
+        DEBUGLOG("screen: %s (%d)", strerror(errno), errno);
+        return TCO_FAILURE;
+    }
+    return TCO_SUCCESS;
+}
+
+/* Action descriptor functions */
+static
+bool tco_set_fd_flags(int fd,
+                      int fdFlags,
+                      int statusFlags)
+{
+    int flags = fcntl(fd, F_GETFD);
+    if(flags == -1 || fcntl(fd, F_SETFD, flags | fdFlags) == -1) {
+        return false;
+    }
+    flags = fcntl(fd, F_GETFL);
+    if(flags == -1 || fcntl(fd, F_SETFL, flags | statusFlags) == -1) {
+        return false;
+    }
+    return true;
+}
+
+static
+int tco_context_get_fd(tco_context_t ctx)
+{
+    if(!ctx) {
+        errno = EINVAL;
+        return TCO_FAILURE;
+    }
+    if(ctx->m_actionPipe[0] != -1) {
+        return ctx->m_actionPipe[0];
+    }
+    int fds[2];
+    if(pipe(fds) == -1) {
+        DEBUGLOG("pipe: %s (%d)", strerror(errno), errno);
+        return TCO_FAILURE;
+    }
+    if(!tco_set_fd_flags(fds[0], FD_CLOEXEC, O_NONBLOCK) ||
+       !tco_set_fd_flags(fds[1], FD_CLOEXEC, O_NONBLOCK)) {
+        DEBUGLOG("fcntl: %s (%d)", strerror(errno), errno);
+        close(fds[0]);
+        close(fds[1]);
+        return TCO_FAILURE;
+    }
+    ctx->m_actionPipe[0] = fds[0];
+    ctx->m_actionPipe[1] = fds[1];
+    ctx->m_queueActions = true;
+    if(!tco_action_queue_empty(&ctx->m_actionQueue)) {
+        char signal = 0;
+        write(fds[1], &signal, 1);
+    }
+    return fds[0];
+}
+
+static
+int tco_context_poll_actions(tco_context_t ctx,
+                             struct tco_action * actions,
+                             int maxActions)
+{
+    tco_action_queue_t queue = &ctx->m_actionQueue;
+    int count = tco_action_queue_pop(queue, actions, maxActions);
+    if(ctx->m_actionPipe[0] == -1 || !tco_action_queue_empty(queue)) {
+        return count;
+    }
+    /* Queue ran dry, consume the wakeups. A producer that found the
+     * queue empty meanwhile may have had its byte drained, so check
+     * again and signal ourselves in that case. */
+    char buffer[64];
+    while(read(ctx->m_actionPipe[0], buffer, sizeof(buffer)) > 0) {
+    }
+    if(!tco_action_queue_empty(queue)) {
+        char signal = 0;
+        write(ctx->m_actionPipe[1], &signal, 1);
+    }
+    return count;
+}
+
+static
+int tco_context_set_latest_wins(tco_context_t ctx,
+                                int enable,
+                                int max_age_ms)
+{
+    if(!ctx || max_age_ms < 0) {
+        return TCO_FAILURE;
+    }
+    ctx->m_latestWins = enable != 0;
+    ctx->m_maxEventAge = (long long)max_age_ms * 1000000LL;
+    ctx->m_eventDelay = LLONG_MAX;
+    return TCO_SUCCESS;
+}
+
+static
+int tco_context_get_event_stats(tco_context_t ctx,
+                                struct tco_event_stats * stats)
+{
+    if(!ctx || !stats) {
+        return TCO_FAILURE;
+    }
+    *stats = ctx->m_eventStats;
+    return TCO_SUCCESS;
+}
+
+static
+int tco_context_get_memory_usage(tco_context_t ctx,
+                                 struct tco_memory_usage * usage)
+{
+    if(!ctx || !usage) {
+        return TCO_FAILURE;
+    }
+    usage->window_buffers = ctx->m_memory[TCO_MEMORY_WINDOW_BUFFERS];
+    usage->pixmaps = ctx->m_memory[TCO_MEMORY_PIXMAPS];
+    usage->heap = ctx->m_memory[TCO_MEMORY_HEAP];
+    usage->cached_images = ctx->m_memory[TCO_MEMORY_CACHED_IMAGES];
+    usage->total = ctx->m_memory[TCO_MEMORY_CATEGORIES];
+    return TCO_SUCCESS;
+}
+
 /* Public TCO API functions */
 int tco_initialize(tco_context_t *context,
                    screen_context_t screenContext,
@@ -2271,11 +5765,58 @@ int tco_loadcontrols(tco_context_t context,
                      const char* user_filename)
 {
     tco_context_t c = (tco_context_t)context;
+    if(!c) {
+        return TCO_FAILURE;
+    }
     return tco_context_load_controls(c,
+                                     c->m_profile,
                                      default_filename,
                                      user_filename);
 }
 
+int tco_loadprofile(tco_context_t context,
+                    const char* name,
+                    const char* default_filename,
+                    const char* user_filename)
+{
+    tco_context_t c = (tco_context_t)context;
+    return tco_context_load_profile(c,
+                                    name,
+                                    default_filename,
+                                    user_filename);
+}
+
+int tco_set_profile(tco_context_t context,
+                    const char* name)
+{
+    tco_context_t c = (tco_context_t)context;
+    return tco_context_set_profile(c, name);
+}
+
+int tco_set_layer_visible(tco_context_t context,
+                          int layer,
+                          int visible)
+{
+    tco_context_t c = (tco_context_t)context;
+    return tco_context_set_layer_visible(c, layer, visible != 0);
+}
+
+int tco_set_editor_grid(tco_context_t context,
+                        int snap,
+                        int avoid_overlap)
+{
+    tco_context_t c = (tco_context_t)context;
+    return tco_context_set_editor_grid(c, snap, avoid_overlap != 0);
+}
+
+int tco_set_idle_policy(tco_context_t context,
+                        int idle_ms,
+                        int fade_ms)
+{
+    tco_context_t c = (tco_context_t)context;
+    return tco_context_set_idle_policy(c, idle_ms, fade_ms);
+}
+
 int tco_savecontrols(tco_context_t context,
                      const char* user_filename)
 {
@@ -2295,6 +5836,62 @@ int tco_handle_events(tco_context_t context,
     return tco_context_handle_events(c, window, event);
 }
 
+int tco_get_state(tco_context_t context,
+                  struct tco_state * state)
+{
+    tco_context_t c = (tco_context_t)context;
+    if(!c || !state) {
+        return TCO_FAILURE;
+    }
+    tco_state_block_read(c->m_stateBlock, state, 0);
+    return TCO_SUCCESS;
+}
+
+int tco_publish_state(tco_context_t context,
+                      const char * name)
+{
+    tco_context_t c = (tco_context_t)context;
+    return tco_context_publish_state(c, name);
+}
+
+int tco_poll_actions(tco_context_t context,
+                     struct tco_action * actions,
+                     int max_actions)
+{
+    tco_context_t c = (tco_context_t)context;
+    if(!c || !actions || max_actions < 0) {
+        return TCO_FAILURE;
+    }
+    return tco_context_poll_actions(c, actions, max_actions);
+}
+
+int tco_tick(tco_context_t context,
+             long long now)
+{
+    tco_context_t c = (tco_context_t)context;
+    if(!c) {
+        return TCO_FAILURE;
+    }
+    tco_context_run_timers(c, now > 0 ? now : tco_clock_now());
+    return TCO_SUCCESS;
+}
+
+int tco_get_timeout(tco_context_t context,
+                    long long now)
+{
+    tco_context_t c = (tco_context_t)context;
+    if(!c) {
+        return -1;
+    }
+    return tco_context_timeout(c, now > 0 ? now : tco_clock_now());
+}
+
+int tco_get_fd(tco_context_t context)
+{
+    tco_context_t c = (tco_context_t)context;
+    return tco_context_get_fd(c);
+}
+
 int tco_draw(tco_context_t context,
              screen_window_t window)
 {
@@ -2302,6 +5899,28 @@ int tco_draw(tco_context_t context,
     return tco_context_draw(c, window);
 }
 
+int tco_set_latest_wins(tco_context_t context,
+                        int enable,
+                        int max_age_ms)
+{
+    tco_context_t c = (tco_context_t)context;
+    return tco_context_set_latest_wins(c, enable, max_age_ms);
+}
+
+int tco_get_event_stats(tco_context_t context,
+                        struct tco_event_stats * stats)
+{
+    tco_context_t c = (tco_context_t)context;
+    return tco_context_get_event_stats(c, stats);
+}
+
+int tco_get_memory_usage(tco_context_t context,
+                         struct tco_memory_usage * usage)
+{
+    tco_context_t c = (tco_context_t)context;
+    return tco_context_get_memory_usage(c, usage);
+}
+
 void tco_shutdown(tco_context_t context)
 {
     tco_context_t c = (tco_context_t)context;
@@ -0,0 +1,73 @@
+#include "string.h"
+#include "tco_pixel.h"
+
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+void tco_pixel_copy_row(void * dst,
+                        const void * src,
+                        size_t bytes)
+{
+    unsigned char * d = (unsigned char *)dst;
+    const unsigned char * s = (const unsigned char *)src;
+    size_t i = 0;
+#if defined(__ARM_NEON__)
+    for (; i + 64 <= bytes; i += 64) {
+        uint8x16_t a = vld1q_u8(s + i);
+        uint8x16_t b = vld1q_u8(s + i + 16);
+        uint8x16_t c = vld1q_u8(s + i + 32);
+        uint8x16_t e = vld1q_u8(s + i + 48);
+        vst1q_u8(d + i, a);
+        vst1q_u8(d + i + 16, b);
+        vst1q_u8(d + i + 32, c);
+        vst1q_u8(d + i + 48, e);
+    }
+#elif defined(__SSE2__)
+    for (; i + 64 <= bytes; i += 64) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(s + i + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *)(s + i + 32));
+        __m128i e = _mm_loadu_si128((const __m128i *)(s + i + 48));
+        _mm_storeu_si128((__m128i *)(d + i), a);
+        _mm_storeu_si128((__m128i *)(d + i + 16), b);
+        _mm_storeu_si128((__m128i *)(d + i + 32), c);
+        _mm_storeu_si128((__m128i *)(d + i + 48), e);
+    }
+#endif
+    if (i < bytes) {
+        memcpy(d + i, s + i, bytes - i);
+    }
+}
+
+void tco_pixel_fill_pattern(uint32_t * dst,
+                            const uint32_t * pattern,
+                            size_t patternLength,
+                            size_t count)
+{
+    size_t filled = patternLength < count ? patternLength : count;
+    memcpy(dst, pattern, filled * sizeof(uint32_t));
+    /* Double the filled prefix, it stays a whole number of periods */
+    while (filled < count) {
+        size_t n = filled < count - filled ? filled : count - filled;
+        tco_pixel_copy_row(dst + filled, dst, n * sizeof(uint32_t));
+        filled += n;
+    }
+}
+
+void tco_pixel_replicate_row(unsigned char * pixels,
+                             int stride,
+                             int rowBytes,
+                             int src,
+                             int first,
+                             int count)
+{
+    const unsigned char * row = pixels + src * stride;
+    unsigned char * p = pixels + first * stride;
+    int i;
+    for (i = 0; i < count; ++i, p += stride) {
+        tco_pixel_copy_row(p, row, rowBytes);
+    }
+}
@@ -0,0 +1,42 @@
+#ifndef _TCO_PIXEL_H_INCLUDED
+#define _TCO_PIXEL_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Pixel kernels for 32-bit RGBA8888 buffers. Pointers need not be aligned. */
+
+/* Set count pixels repeating the first patternLength pixels of pattern */
+void tco_pixel_fill_pattern(uint32_t * dst,
+                            const uint32_t * pattern,
+                            size_t patternLength,
+                            size_t count);
+
+/* Copy bytes of a row, src and dst must not overlap */
+void tco_pixel_copy_row(void * dst,
+                        const void * src,
+                        size_t bytes);
+
+/* Copy row src into rows [first, first + count) of a buffer */
+void tco_pixel_replicate_row(unsigned char * pixels,
+                             int stride,
+                             int rowBytes,
+                             int src,
+                             int first,
+                             int count);
+
+/* Pack a pixel the way RGBA8888 bytes lie in memory */
+static inline
+uint32_t tco_pixel_rgba(unsigned char r,
+                        unsigned char g,
+                        unsigned char b,
+                        unsigned char a)
+{
+    union {
+        unsigned char bytes[4];
+        uint32_t value;
+    } p = {{r, g, b, a}};
+    return p.value;
+}
+
+#endif /* _TCO_PIXEL_H_INCLUDED */
@@ -0,0 +1,131 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "tco_shm.h"
+
+#define TCO_SHM_READ_RETRIES 1024
+
+struct tco_shm_reader {
+    const struct tco_state_block * m_block;
+};
+
+void tco_state_block_init(struct tco_state_block * block)
+{
+    memset(block, 0, sizeof(*block));
+    block->m_magic = TCO_STATE_MAGIC;
+    block->m_version = TCO_STATE_VERSION;
+    block->m_size = sizeof(struct tco_state);
+}
+
+void tco_state_block_begin(struct tco_state_block * block)
+{
+    block->m_seq++;
+    /* Odd sequence is visible before any field changes */
+    __sync_synchronize();
+}
+
+void tco_state_block_end(struct tco_state_block * block)
+{
+    block->m_state.sequence++;
+    /* Fields are visible before the sequence turns even */
+    __sync_synchronize();
+    block->m_seq++;
+}
+
+bool tco_state_block_read(const struct tco_state_block * block,
+                          struct tco_state * state,
+                          int maxRetries)
+{
+    int attempt = 0;
+    for(;;) {
+        unsigned int seq = block->m_seq;
+        __sync_synchronize();
+        memcpy(state, &block->m_state, sizeof(*state));
+        __sync_synchronize();
+        if(!(seq & 1) && seq == block->m_seq) {
+            return true;
+        }
+        if(maxRetries > 0 && ++attempt >= maxRetries) {
+            return false;
+        }
+    }
+}
+
+int tco_state_key_down(const struct tco_state * state,
+                       int sym)
+{
+    if(!state || sym < 0 || sym >= TCO_STATE_MAX_KEYS) {
+        return 0;
+    }
+    return (state->keys[sym >> 5] >> (sym & 31)) & 1;
+}
+
+tco_shm_reader_t tco_shm_open(const char * name)
+{
+    if(!name) {
+        errno = EINVAL;
+        return NULL;
+    }
+    int fd = shm_open(name, O_RDONLY, 0);
+    if(fd == -1) {
+        return NULL;
+    }
+    struct stat st;
+    if(fstat(fd, &st) == -1) {
+        close(fd);
+        return NULL;
+    }
+    if(st.st_size < (off_t)sizeof(struct tco_state_block)) {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+    void * addr = mmap(NULL, sizeof(struct tco_state_block), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(addr == MAP_FAILED) {
+        return NULL;
+    }
+    const struct tco_state_block * block = (const struct tco_state_block *)addr;
+    if(block->m_magic != TCO_STATE_MAGIC ||
+       block->m_version != TCO_STATE_VERSION ||
+       block->m_size != sizeof(struct tco_state)) {
+        munmap(addr, sizeof(struct tco_state_block));
+        errno = EINVAL;
+        return NULL;
+    }
+    tco_shm_reader_t reader = (tco_shm_reader_t)calloc(1, sizeof(struct tco_shm_reader));
+    if(!reader) {
+        munmap(addr, sizeof(struct tco_state_block));
+        errno = ENOMEM;
+        return NULL;
+    }
+    reader->m_block = block;
+    return reader;
+}
+
+int tco_shm_read(tco_shm_reader_t reader,
+                 struct tco_state * state)
+{
+    if(!reader || !state) {
+        errno = EINVAL;
+        return -1;
+    }
+    if(!tco_state_block_read(reader->m_block, state, TCO_SHM_READ_RETRIES)) {
+        errno = EAGAIN;
+        return -1;
+    }
+    return 0;
+}
+
+void tco_shm_close(tco_shm_reader_t reader)
+{
+    if(!reader) {
+        return;
+    }
+    munmap((void *)reader->m_block, sizeof(struct tco_state_block));
+    free(reader);
+}
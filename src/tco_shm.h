@@ -0,0 +1,33 @@
+#ifndef _TCO_SHM_H_INCLUDED
+#define _TCO_SHM_H_INCLUDED
+
+#include <stdbool.h>
+#include "tco_state.h"
+
+#define TCO_STATE_MAGIC   0x53434f54 /* "TOCS" */
+#define TCO_STATE_VERSION 1
+
+/* Seqlock protected input state, embedded in the context or mapped
+ * from a shared memory object. m_seq is odd while m_state is written. */
+struct tco_state_block {
+    unsigned int          m_magic;
+    unsigned int          m_version;
+    unsigned int          m_size; /* sizeof(struct tco_state) */
+    volatile unsigned int m_seq;
+    struct tco_state      m_state;
+};
+
+/* Set up the header of an empty block */
+void tco_state_block_init(struct tco_state_block * block);
+
+/* Bracket an update of block->m_state, single writer only */
+void tco_state_block_begin(struct tco_state_block * block);
+void tco_state_block_end(struct tco_state_block * block);
+
+/* Copy a consistent snapshot, gives up after maxRetries attempts
+ * if maxRetries is positive */
+bool tco_state_block_read(const struct tco_state_block * block,
+                          struct tco_state * state,
+                          int maxRetries);
+
+#endif /* _TCO_SHM_H_INCLUDED */